@@ -0,0 +1,38 @@
+
+#include <stdlib.h>         /* strtoull, strtod */
+#include <stdio.h>          /* printf */
+#include <time.h>           /* clock_gettime */
+
+#include "../src/counting_bloom.h"
+#include "../src/counting_bloom_bulk.h"
+
+
+/*
+	Build a counting bloom from files of keys (one per line) and export it:
+		cblmbulk <output> <estimated elements> <false positive rate> <threads> <file> [file ...]
+*/
+int main(int argc, char** argv) {
+	if (argc < 6) {
+		fprintf(stderr, "Usage: %s <output> <estimated elements> <false positive rate> <threads> <file> [file ...]\n", argv[0]);
+		return 1;
+	}
+	uint64_t estimated_elements = strtoull(argv[2], NULL, 10);
+	float false_positive_rate = (float)strtod(argv[3], NULL);
+	unsigned int number_threads = (unsigned int)strtoul(argv[4], NULL, 10);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CountingBloom cb;
+	if (counting_bloom_bulk_build(&cb, estimated_elements, false_positive_rate, NULL, (const char* const*)&argv[5], argc - 5, number_threads) == COUNTING_BLOOM_FAILURE) {
+		fprintf(stderr, "Unable to build the counting bloom!\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Added %" PRIu64 " keys with %u threads in %.3f seconds\n", cb.elements_added, number_threads, seconds);
+
+	int res = counting_bloom_export(&cb, argv[1]);
+	counting_bloom_stats(&cb);
+	counting_bloom_destroy(&cb);
+	return (res == COUNTING_BLOOM_SUCCESS) ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+
+#include <stdlib.h>         /* calloc, malloc */
+#include <stdio.h>          /* printf */
+#include <string.h>         /* strlen */
+#include <time.h>           /* clock_gettime */
+
+#include "../src/counting_bloom.h"
+
+#define NUMBER_HASHES 7
+#define ITERATIONS 200000
+
+
+/*
+	The original default hash; each seed re-reads the full key (and re-runs
+	strlen) which is what the single pass hashing replaces.
+*/
+static uint64_t per_seed_fnv_1a(const char* key, int seed) {
+	int i, len = strlen(key);
+	uint64_t h = 14695981039346656037ULL + (31 * seed);
+	for (i = 0; i < len; ++i) {
+		h = h ^ (unsigned char) key[i];
+		h = h * 1099511628211ULL;
+	}
+	return h;
+}
+
+static void per_seed_hash(int num_hashes, const char* str, uint64_t* results) {
+	for (int i = 0; i < num_hashes; ++i) {
+		results[i] = per_seed_fnv_1a(str, i);
+	}
+}
+
+static double elapsed(const struct timespec* start, const struct timespec* end) {
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main() {
+	printf("Testing Counting Bloom version %s\n", counting_bloom_get_version());
+	printf("Hashing benchmark with %d hashes and %d iterations per key length\n\n", NUMBER_HASHES, ITERATIONS);
+
+	CountingBloom cb;
+	counting_bloom_init(&cb, 10, 0.01);
+
+	size_t lengths[] = {8, 16, 32, 64, 128, 256, 512};
+	uint64_t expected[NUMBER_HASHES], hashes[NUMBER_HASHES];
+	uint64_t sink = 0;
+
+	printf("%8s %14s %14s %8s\n", "key len", "per seed (ns)", "one pass (ns)", "speedup");
+	for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+		char* key = (char*)calloc(lengths[l] + 1, sizeof(char));
+		for (size_t i = 0; i < lengths[l]; ++i) {
+			key[i] = 'a' + (i % 26);
+		}
+
+		per_seed_hash(NUMBER_HASHES, key, expected);
+		counting_bloom_calculate_hashes_into(&cb, key, NUMBER_HASHES, hashes);
+		if (memcmp(expected, hashes, sizeof(hashes)) != 0) {
+			printf("Hash mismatch for key length %zu!\n", lengths[l]);
+			free(key);
+			counting_bloom_destroy(&cb);
+			return 1;
+		}
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < ITERATIONS; ++i) {
+			key[0] = 'a' + (i % 26);
+			per_seed_hash(NUMBER_HASHES, key, hashes);
+			sink += hashes[NUMBER_HASHES - 1];
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double old_ns = elapsed(&start, &end) * 1e9 / ITERATIONS;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < ITERATIONS; ++i) {
+			key[0] = 'a' + (i % 26);
+			counting_bloom_calculate_hashes_into(&cb, key, NUMBER_HASHES, hashes);
+			sink += hashes[NUMBER_HASHES - 1];
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double new_ns = elapsed(&start, &end) * 1e9 / ITERATIONS;
+
+		printf("%8zu %14.1f %14.1f %7.2fx\n", lengths[l], old_ns, new_ns, old_ns / new_ns);
+		free(key);
+	}
+	counting_bloom_destroy(&cb);
+
+	/* compare the built-in hash types */
+	CountingBloomHashType types[] = {COUNTING_BLOOM_HASH_TYPE_FNV_1A, COUNTING_BLOOM_HASH_TYPE_WYHASH, COUNTING_BLOOM_HASH_TYPE_CRC32C};
+	CountingBloom blooms[3];
+	for (int t = 0; t < 3; ++t) {
+		CountingBloomOptions opts;
+		counting_bloom_options_init(&opts);
+		opts.hash_type = types[t];
+		counting_bloom_init_opts(&blooms[t], 10, 0.01, &opts);
+	}
+	printf("\n%8s %14s %14s %14s\n", "key len", "fnv-1a (ns)", "wyhash (ns)", "crc32c (ns)");
+	for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+		char* key = (char*)calloc(lengths[l] + 1, sizeof(char));
+		for (size_t i = 0; i < lengths[l]; ++i) {
+			key[i] = 'a' + (i % 26);
+		}
+		printf("%8zu", lengths[l]);
+		for (int t = 0; t < 3; ++t) {
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (int i = 0; i < ITERATIONS; ++i) {
+				key[0] = 'a' + (i % 26);
+				counting_bloom_calculate_hashes_bytes_into(&blooms[t], key, lengths[l], NUMBER_HASHES, hashes);
+				sink += hashes[NUMBER_HASHES - 1];
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			printf(" %14.1f", elapsed(&start, &end) * 1e9 / ITERATIONS);
+		}
+		printf("\n");
+		free(key);
+	}
+	for (int t = 0; t < 3; ++t) {
+		counting_bloom_destroy(&blooms[t]);
+	}
+
+	printf("\n(checksum %" PRIu64 ")\n", sink);
+	return 0;
+}
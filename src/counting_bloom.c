@@ -11,13 +11,19 @@
 #include <math.h>           /* pow, exp */
 #include <stdlib.h>         /* calloc, malloc */
 #include <stdio.h>          /* printf */
-#include <string.h>         /* strlen */
+#include <string.h>         /* strlen, memcpy, memset */
 #include <stdint.h>         /* UINT32_MAX */
-#include <fcntl.h>          /* open, O_RDWR */
-#include <unistd.h>         /* for close */
+#include <fcntl.h>          /* open, O_RDWR, posix_fallocate */
+#include <unistd.h>         /* for close, ftruncate, getpid */
 #include <sys/types.h>      /* */
 #include <sys/stat.h>       /* fstat */
-#include <sys/mman.h>       /* mmap, mummap */
+#include <sys/mman.h>       /* mmap, mummap, shm_open */
+#include <sched.h>          /* sched_yield */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>      /* _mm_crc32_u64, _mm_crc32_u8, gathers */
+#define COUNTING_BLOOM_X86_64
+#endif
 
 #include "counting_bloom.h"
 
@@ -25,52 +31,170 @@ typedef char *caddr_t;
 
 static const double LOG_TWO_SQUARED = 0.4804530139182;
 
+/*
+    Filters that use non-default options write an extension block between the
+    counters and the original trailer; the original trailer stays at the end of
+    the file so the elements added offset and pyprobables trailer parsing are
+    unchanged. The block ends with its length and a magic number so that fields
+    can be appended over time:
+        uint64_t number_bits
+        uint32_t fields[EXT_FIELD_COUNT]
+        uint32_t extension length (in bytes; including these last two fields)
+        uint32_t magic
+    Fields missing from a shorter block keep their default value.
+*/
+enum {
+    EXT_NUMBER_HASHES,
+    EXT_HASH_MODE,
+    EXT_INDEX_MODE,
+    EXT_HASH_TYPE,
+    EXT_COUNTER_WIDTH,
+    EXT_BLOCK_SIZE,
+    EXT_FIELD_COUNT
+};
+static const uint32_t EXTENSION_MAGIC = 0x43424c58;  // 'CBLX'
+
+/*
+    Shared memory and replica files start with this header, padded to a cache line
+    (or to the block size so that blocks stay aligned), followed by the counters. The
+    creator sets ready last so an attaching process never sees a partial header.
+    Replicas are published under the sequence lock: odd while the counters change.
+*/
+typedef struct {
+    uint32_t magic;
+    uint32_t ready;
+    uint64_t sequence;
+    uint64_t estimated_elements;
+    uint64_t number_bits;
+    uint64_t elements_added;
+    float false_positive_probability;
+    uint32_t fields[EXT_FIELD_COUNT];
+} SharedHeader;
+static const uint32_t SHARED_MAGIC = 0x43424c4d;  // 'CBLM'
+static const long TRAILER_SIZE = sizeof(uint64_t) * 2 + sizeof(float);
+static const uint32_t EXTENSION_SIZE = sizeof(uint64_t) + sizeof(uint32_t) * (EXT_FIELD_COUNT + 2);
+
+/*  Batches hash this many keys ahead of the key whose counters are updated so the
+    prefetches for the counters have time to complete */
+static const unsigned int BATCH_WINDOW = 8;
+
+/* Called for each key of a batch, in order, once its counters have been prefetched */
+typedef void (*BatchFunction)(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+
+/* State for the batches that change the counters; changed is the number of keys added or removed */
+typedef struct {
+    CountingBloom* cb;
+    uint8_t* results;
+    uint64_t changed;
+} BatchUpdateState;
+
 /*******************************************************************************
 ***		PRIVATE FUNCTIONS
 *******************************************************************************/
 static uint64_t* __default_hash(int num_hashes, const char* str);
-static uint64_t __fnv_1a(const char* key, int seed);
+static void __default_hash_into(int num_hashes, const char* str, uint64_t* results);
+static void __default_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results);
+static void __set_hash_functions(CountingBloom* cb, const CountingBloomOptions* opts);
+static __inline__ void __double_hashes(uint64_t h1, uint64_t h2, unsigned int number_hashes, uint64_t* results);
+static void __wyhash_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results);
+static void __crc32c_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results);
+#ifdef COUNTING_BLOOM_X86_64
+static void __crc32c_hash_bytes_sse42(int num_hashes, const void* key, size_t len, uint64_t* results);
+static uint32_t __probe_32_avx2(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes);
+static uint32_t __probe_32_avx512(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes);
+#endif
+static uint32_t __probe_32(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes);
+static void __set_runtime_options(CountingBloom* cb, const CountingBloomOptions* opts);
+static void __fnv_1a_seeded(const unsigned char* key, size_t len, int num_hashes, uint64_t* results);
+static int __init_parameters(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts);
 static void __calculate_optimal_hashes(CountingBloom* cb);
-static void __write_to_file(const CountingBloom* cb, FILE* fp, short on_disk);
-static void __read_from_file(CountingBloom* cb, FILE* fp, short on_disk, const char* filename);
+static __inline__ uint64_t __counter_bytes(const CountingBloom* cb);
+static __inline__ uint32_t __counter_max(const CountingBloom* cb);
+static __inline__ uint32_t __get_counter(const CountingBloom* cb, uint64_t idx);
+static __inline__ void __set_counter(CountingBloom* cb, uint64_t idx, uint32_t value);
+static void __merge_counters(CountingBloom* cb, const CountingBloom* other);
+static double __blocked_false_positive_rate(uint64_t estimated_elements, uint64_t number_blocks, unsigned int block_counters, unsigned int number_hashes);
+static __inline__ double __poisson(double lambda, uint64_t i);
+static void __update_block_layout(CountingBloom* cb);
+static uint32_t* __allocate_counters(const CountingBloom* cb);
+static __inline__ void __calculate_indices(const CountingBloom* cb, const uint64_t* hashes, uint64_t* indices);
+static __inline__ uint64_t __reduce(const CountingBloom* cb, uint64_t hash, uint64_t range);
+static __inline__ uint64_t __mul_hi_64(uint64_t a, uint64_t b);
+static __inline__ void __increment_counters(CountingBloom* cb, const uint64_t* indices, uint64_t n);
+static __inline__ void __decrement_counters(CountingBloom* cb, const uint64_t* indices);
+static __inline__ int __check_counters(const CountingBloom* cb, const uint64_t* indices);
+static __inline__ uint32_t __min_counter(const CountingBloom* cb, const uint64_t* indices);
+static __inline__ void __prefetch_counters(const CountingBloom* cb, const uint64_t* indices, short for_write);
+static int __batch_indices(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t i, uint64_t* indices, short for_write);
+static int __run_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, short for_write, BatchFunction fn, void* state, uint64_t* processed);
+static void __batch_add(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+static void __batch_check(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+static void __batch_max_insertions(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+static void __batch_remove(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+static void __batch_check_and_add(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state);
+static int __write_to_file(const CountingBloom* cb, FILE* fp, short on_disk);
+static int __read_from_file(CountingBloom* cb, FILE* fp, short on_disk, const char* filename);
+static int __has_extension(const CountingBloom* cb);
+static void __write_extension(const CountingBloom* cb, FILE* fp);
+static long __read_extension(CountingBloom* cb, FILE* fp);
+static void __get_fields(const CountingBloom* cb, uint32_t* fields);
+static void __set_fields(CountingBloom* cb, const uint32_t* fields);
+static int __check_layout(const CountingBloom* cb);
+static void __shared_options(CountingBloomOptions* opts, const CountingBloomOptions* passed);
+static uint64_t __shared_offset(const CountingBloom* cb);
+static int __create_shared(CountingBloom* cb, int fd, const char* name);
+static int __open_shared(CountingBloom* cb, int fd, int prot, const char* name, const CountingBloomOptions* opts);
+static void __set_shared(CountingBloom* cb, void* mapping, uint64_t size);
+static int __same_parameters(const CountingBloom* cb, const CountingBloom* other);
+static __inline__ uint64_t __get_elements_added(const CountingBloom* cb);
+static int __calculate_hashes(const CountingBloom* cb, const void* key, size_t len, short is_string, unsigned int number_hashes, uint64_t* results);
+static int __calculate_hashes_with_function(const CountingBloom* cb, const void* key, size_t len, short is_string, unsigned int number_hashes, uint64_t* results);
+static int __calculate_hashes_string(const CountingBloom* cb, const char* str, unsigned int number_hashes, uint64_t* results);
 static void __get_additional_stats(const CountingBloom* cb, uint64_t* largest, uint64_t* largest_index,uint64_t* els_added, float *fullness);
 static void __update_elements_added_on_disk(CountingBloom* cb);
+static __inline__ void __change_elements_added(CountingBloom* cb, int64_t change);
+static __inline__ uint32_t __atomic_get_counter(const CountingBloom* cb, uint64_t idx);
+static __inline__ void __atomic_update_counter(CountingBloom* cb, uint64_t idx, int64_t delta, int64_t peak);
+static __inline__ uint32_t __apply_delta(uint32_t value, int64_t delta, int64_t peak, uint32_t max);
+static CountingBloomDelta* __find_delta(CountingBloomDeltas* deltas, uint64_t idx, short insert);
+static void __reserve_deltas(CountingBloomDeltas* deltas);
 
 
 /*******************************************************************************
 ***		PUBLIC FUNCTION DECLARATIONS
 *******************************************************************************/
-int counting_bloom_init_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, CountBloomHashFunction hash_function) {
-    if(estimated_elements == 0 || estimated_elements > UINT64_MAX) {
-        return COUNTING_BLOOM_FAILURE;
-    }
-    if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0 ) {
+void counting_bloom_options_init(CountingBloomOptions* opts) {
+    memset(opts, 0, sizeof(CountingBloomOptions));
+}
+
+int counting_bloom_init_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts) {
+    if (__init_parameters(cb, estimated_elements, false_positive_rate, opts) == COUNTING_BLOOM_FAILURE) {
         return COUNTING_BLOOM_FAILURE;
     }
-    cb->estimated_elements = estimated_elements;
-    cb->false_positive_probability = false_positive_rate;
-    __calculate_optimal_hashes(cb);
-    cb->bloom = (uint32_t*)calloc(cb->number_bits, sizeof(uint32_t));
+    cb->bloom = __allocate_counters(cb);
     cb->elements_added = 0;
     cb->__is_on_disk = 0;
-    cb->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    cb->filepointer = NULL;
+    __set_hash_functions(cb, opts);
+    __set_runtime_options(cb, opts);
     return COUNTING_BLOOM_SUCCESS;
 }
 
+int counting_bloom_init_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, CountBloomHashFunction hash_function) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_function = hash_function;
+    return counting_bloom_init_opts(cb, estimated_elements, false_positive_rate, &opts);
+}
 
-int counting_bloom_init_on_disk_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath, CountBloomHashFunction hash_function){
-    if(estimated_elements == 0 || estimated_elements > UINT64_MAX) {
+int counting_bloom_init_on_disk_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath, const CountingBloomOptions* opts) {
+    if (__init_parameters(cb, estimated_elements, false_positive_rate, opts) == COUNTING_BLOOM_FAILURE) {
         return COUNTING_BLOOM_FAILURE;
     }
-    if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0 ) {
-        return COUNTING_BLOOM_FAILURE;
-    }
-    cb->estimated_elements = estimated_elements;
-    cb->false_positive_probability = false_positive_rate;
-    __calculate_optimal_hashes(cb);
     cb->elements_added = 0;
     cb->__is_on_disk = 1;
-    cb->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    __set_hash_functions(cb, opts);
+    __set_runtime_options(cb, opts);
 
     FILE* fp;
     fp = fopen(filepath, "w+b");
@@ -78,15 +202,174 @@ int counting_bloom_init_on_disk_alt(CountingBloom* cb, uint64_t estimated_elemen
         fprintf(stderr, "Can't open file %s!\n", filepath);
         return COUNTING_BLOOM_FAILURE;
     }
-    __write_to_file(cb, fp, 1);
+    int res = __write_to_file(cb, fp, 1);
+    if (res == COUNTING_BLOOM_SUCCESS && opts != NULL && opts->preallocate != 0) {
+        fflush(fp);
+        res = (posix_fallocate(fileno(fp), 0, ftell(fp)) == 0) ? COUNTING_BLOOM_SUCCESS : COUNTING_BLOOM_FAILURE;
+    }
     fclose(fp);
-    return counting_bloom_import_on_disk_alt(cb, filepath, hash_function);
+    if (res == COUNTING_BLOOM_FAILURE) {
+        fprintf(stderr, "Can't size file %s!\n", filepath);
+        remove(filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_import_on_disk_opts(cb, filepath, opts);
+}
+
+int counting_bloom_init_on_disk_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath, CountBloomHashFunction hash_function) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_function = hash_function;
+    return counting_bloom_init_on_disk_opts(cb, estimated_elements, false_positive_rate, filepath, &opts);
+}
+
+int counting_bloom_init_shared_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* name, const CountingBloomOptions* opts) {
+    CountingBloomOptions options;
+    __shared_options(&options, opts);
+    if (__init_parameters(cb, estimated_elements, false_positive_rate, &options) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create shared memory %s!\n", name);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    cb->elements_added = 0;
+    cb->__is_on_disk = 0;
+    cb->filepointer = NULL;
+    __set_hash_functions(cb, &options);
+    __set_runtime_options(cb, &options);
+    int res = __create_shared(cb, fd, name);
+    close(fd);
+    if (res == COUNTING_BLOOM_FAILURE) {
+        shm_unlink(name);
+    }
+    return res;
+}
+
+int counting_bloom_attach_shared_opts(CountingBloom* cb, const char* name, const CountingBloomOptions* opts) {
+    CountingBloomOptions options;
+    __shared_options(&options, opts);
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open shared memory %s!\n", name);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    int res = __open_shared(cb, fd, PROT_READ | PROT_WRITE, name, &options);
+    close(fd);
+    return res;
+}
+
+int counting_bloom_unlink_shared(const char* name) {
+    return (shm_unlink(name) == 0) ? COUNTING_BLOOM_SUCCESS : COUNTING_BLOOM_FAILURE;
+}
+
+int counting_bloom_init_replica(CountingBloom* replica, const CountingBloom* cb, const char* filepath) {
+    // build the replica under a temporary name and rename it into place; readers of a
+    // replica already at filepath keep their mapping of the old file rather than having
+    // it truncated underneath them
+    size_t len = strlen(filepath) + 32;
+    char* tmppath = (char*)malloc(len);
+    if (tmppath == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    snprintf(tmppath, len, "%s.%ld.tmp", filepath, (long)getpid());
+    int fd = open(tmppath, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open replica %s!\n", tmppath);
+        free(tmppath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    // the replica has all of the parameters and hash functions of the master
+    memcpy(replica, cb, sizeof(CountingBloom));
+    replica->bloom = NULL;
+    replica->elements_added = 0;
+    replica->concurrent = 1;
+    replica->__mapping = NULL;
+    replica->__shared_elements_added = NULL;
+    replica->__is_on_disk = 0;
+    replica->__filesize = 0;
+    replica->filepointer = NULL;
+    int res = __create_shared(replica, fd, tmppath);
+    close(fd);
+    if (res == COUNTING_BLOOM_SUCCESS) {
+        res = counting_bloom_replica_publish(replica, cb);
+    }
+    if (res == COUNTING_BLOOM_SUCCESS && rename(tmppath, filepath) != 0) {
+        fprintf(stderr, "Can't replace replica %s!\n", filepath);
+        res = COUNTING_BLOOM_FAILURE;
+    }
+    if (res == COUNTING_BLOOM_FAILURE) {
+        if (replica->__mapping != NULL) {
+            munmap(replica->__mapping, replica->__filesize);
+            replica->__mapping = NULL;
+        }
+        remove(tmppath);
+    }
+    free(tmppath);
+    return res;
+}
+
+int counting_bloom_replica_publish(CountingBloom* replica, const CountingBloom* cb) {
+    if (replica->__mapping == NULL || __same_parameters(replica, cb) == 0) {
+        fprintf(stderr, "Unable to publish a counting bloom with different parameters!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    SharedHeader* header = (SharedHeader*)replica->__mapping;
+    uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);  // odd: a publish is in progress
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(replica->bloom, cb->bloom, __counter_bytes(cb));
+    replica->elements_added = __get_elements_added(cb);
+    __atomic_store_n(&header->elements_added, replica->elements_added, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_open_replica_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts) {
+    CountingBloomOptions options;
+    __shared_options(&options, opts);
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open replica %s!\n", filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    int res = __open_shared(cb, fd, PROT_READ, filepath, &options);
+    close(fd);
+    return res;
+}
+
+uint64_t counting_bloom_replica_read_begin(const CountingBloom* cb) {
+    if (cb->__mapping == NULL) {  // nothing publishes into a counting bloom that is not mapped
+        return 0;
+    }
+    const SharedHeader* header = (const SharedHeader*)cb->__mapping;
+    uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    while ((sequence & 1) == 1) {
+        sched_yield();
+        sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    }
+    return sequence;
+}
+
+int counting_bloom_replica_read_retry(const CountingBloom* cb, uint64_t sequence) {
+    if (cb->__mapping == NULL) {
+        return 0;
+    }
+    const SharedHeader* header = (const SharedHeader*)cb->__mapping;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);  // the counter reads happen before the sequence is checked again
+    return __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence;
 }
 
 int counting_bloom_destroy(CountingBloom* cb) {
-    if (cb->__is_on_disk == 0) {
+    if (cb->__mapping != NULL) {
+        munmap(cb->__mapping, cb->__filesize);
+    } else if (cb->__is_on_disk == 0) {
         free(cb->bloom);
     } else {
+        if (cb->concurrent == 1) {
+            __update_elements_added_on_disk(cb);
+        }
         fclose(cb->filepointer);
         munmap(cb->bloom, cb->__filesize);
     }
@@ -94,9 +377,23 @@ int counting_bloom_destroy(CountingBloom* cb) {
     cb->false_positive_probability = 0.0;
     cb->number_hashes = 0;
     cb->number_bits = 0;
+    cb->hash_mode = COUNTING_BLOOM_HASH_SEEDED;
+    cb->index_mode = COUNTING_BLOOM_INDEX_MODULO;
+    cb->hash_type = COUNTING_BLOOM_HASH_TYPE_FNV_1A;
+    cb->counter_width = 0;
+    cb->block_size = 0;
+    cb->__number_blocks = 0;
+    cb->__block_counters = 0;
+    cb->__block_shift = 0;
     cb->bloom = NULL;
     cb->elements_added = 0;
     cb->hash_function = NULL;
+    cb->hash_function_into = NULL;
+    cb->hash_function_bytes = NULL;
+    cb->__probe_32 = NULL;
+    cb->concurrent = 0;
+    cb->__mapping = NULL;
+    cb->__shared_elements_added = NULL;
     cb->__is_on_disk = 0;
     cb->__filesize = 0;
     cb->filepointer = NULL;
@@ -104,19 +401,35 @@ int counting_bloom_destroy(CountingBloom* cb) {
 }
 
 int counting_bloom_clear(CountingBloom* cb) {
-    for (unsigned int i = 0; i < cb->number_bits; ++i) {
-        cb->bloom[i] = 0;
-    }
+    memset(cb->bloom, 0, __counter_bytes(cb));
     cb->elements_added = 0;
+    if (cb->__shared_elements_added != NULL) {
+        __atomic_store_n(cb->__shared_elements_added, 0, __ATOMIC_RELAXED);
+    }
     __update_elements_added_on_disk(cb);
     return COUNTING_BLOOM_SUCCESS;
 }
 
 int counting_bloom_add_string(CountingBloom* cb, const char* str) {
-    uint64_t* hashes = counting_bloom_calculate_hashes(cb, str, cb->number_hashes);
-    int r = counting_bloom_add_string_alt(cb, hashes, cb->number_hashes);
-    free(hashes);
-    return r;
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(cb, str, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_add_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_add_bytes(CountingBloom* cb, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_add_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_add_u64(CountingBloom* cb, uint64_t key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    counting_bloom_calculate_hashes_u64_into(key, cb->number_hashes, hashes);
+    return counting_bloom_add_string_alt(cb, hashes, cb->number_hashes);
 }
 
 int counting_bloom_add_string_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
@@ -127,92 +440,230 @@ int counting_bloom_add_string_alt(CountingBloom* cb, const uint64_t* hashes, uns
     /* NOTE: There are instances of "double" counting when the same idx if found multiple
             times in a single list of hashes... not sure if this is correct or if that
             should be checked for and addressed; make sure compatible with pyprobables */
-    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
-        uint64_t idx = hashes[i] % cb->number_bits;
-        if (cb->bloom[idx] < UINT32_MAX) {
-            ++cb->bloom[idx];
-        }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    __increment_counters(cb, indices, cb->number_hashes);
+    __change_elements_added(cb, 1);  // I could be convinced that if it is a duplicate than it shouldn't increment the elements added
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_add_indices(CountingBloom* cb, const uint64_t* indices, uint64_t number_indices, uint64_t number_elements) {
+    __increment_counters(cb, indices, number_indices);
+    if (number_elements > 0) {
+        __change_elements_added(cb, (int64_t)number_elements);
     }
-    ++cb->elements_added;  // I could be convinced that if it is a duplicate than it shouldn't increment the elements added
-    __update_elements_added_on_disk(cb);
     return COUNTING_BLOOM_SUCCESS;
 }
 
-int counting_bloom_check_string(const CountingBloom* cb, const char* str) {
-    uint64_t* hashes = counting_bloom_calculate_hashes(cb, str, cb->number_hashes);
-    int r = counting_bloom_check_string_alt(cb, hashes, cb->number_hashes);
-    free(hashes);
-    return r;
+int counting_bloom_add_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n) {
+    uint64_t added = 0;
+    int res = __run_batch(cb, keys, lens, n, 1, __batch_add, cb, &added);
+    __change_elements_added(cb, (int64_t)added);
+    return res;
 }
 
-int counting_bloom_check_string_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
+int counting_bloom_check_and_add(CountingBloom* cb, const char* str) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(cb, str, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_check_and_add_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_check_and_add_bytes(CountingBloom* cb, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_check_and_add_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_check_and_add_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
     if (number_hashes_passed < cb->number_hashes) {
         fprintf(stderr, "Error: Not enough hashes were passed!\n");
         return COUNTING_BLOOM_FAILURE;
     }
-    int res = COUNTING_BLOOM_SUCCESS;
-    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
-        uint64_t idx = hashes[i] % cb->number_bits;
-        if (cb->bloom[idx] == 0) {
-            res = COUNTING_BLOOM_FAILURE;
-            break;
-        }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    if (__check_counters(cb, indices) == COUNTING_BLOOM_SUCCESS) {
+        return COUNTING_BLOOM_PRESENT;
     }
+    __increment_counters(cb, indices, cb->number_hashes);  // the counters are already in cache from the check
+    __change_elements_added(cb, 1);
+    return COUNTING_BLOOM_ADDED;
+}
+
+int counting_bloom_check_and_add_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results) {
+    BatchUpdateState state;
+    state.cb = cb;
+    state.results = results;
+    state.changed = 0;
+    memset(results, 0, (n + 7) / 8);
+    int res = __run_batch(cb, keys, lens, n, 1, __batch_check_and_add, &state, NULL);
+    __change_elements_added(cb, (int64_t)state.changed);
     return res;
 }
 
-// a better way would be to calculate the hashes only once...
+int counting_bloom_check_string(const CountingBloom* cb, const char* str) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(cb, str, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_check_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_check_bytes(const CountingBloom* cb, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_check_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_check_u64(const CountingBloom* cb, uint64_t key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    counting_bloom_calculate_hashes_u64_into(key, cb->number_hashes, hashes);
+    return counting_bloom_check_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_check_string_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    return __check_counters(cb, indices);
+}
+
+int counting_bloom_check_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results) {
+    memset(results, 0, (n + 7) / 8);
+    return __run_batch(cb, keys, lens, n, 0, __batch_check, results, NULL);
+}
+
 int counting_bloom_get_max_insertions(const CountingBloom* cb, const char* str) {
-    uint64_t* hashes = counting_bloom_calculate_hashes(cb, str, cb->number_hashes);
-    int r = counting_bloom_get_max_insertions_alt(cb, hashes, cb->number_hashes);
-    free(hashes);
-    return r;
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(cb, str, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return 0;
+    }
+    return counting_bloom_get_max_insertions_alt(cb, hashes, cb->number_hashes);
 }
 
-int counting_bloom_get_max_insertions_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
-    if (counting_bloom_check_string_alt(cb, hashes, number_hashes_passed) == COUNTING_BLOOM_FAILURE) {
-        return 0; // this means it isn't present; fail-quick
+int counting_bloom_get_max_insertions_bytes(const CountingBloom* cb, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return 0;
     }
-    uint32_t res = UINT32_MAX; // set this to the max and work down
-    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
-        uint64_t idx = hashes[i] % cb->number_bits;
-        // if (cb->bloom[idx] == 0)
-        //     return 0;  // not present, no need to continue
-        if (cb->bloom[idx] < res) {
-            res = cb->bloom[idx];
-        }
+    return counting_bloom_get_max_insertions_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_get_max_insertions_u64(const CountingBloom* cb, uint64_t key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    counting_bloom_calculate_hashes_u64_into(key, cb->number_hashes, hashes);
+    return counting_bloom_get_max_insertions_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_get_max_insertions_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return 0;
     }
-    return res;
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    return __min_counter(cb, indices);
+}
+
+int counting_bloom_get_max_insertions_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint32_t* results) {
+    memset(results, 0, n * sizeof(uint32_t));
+    return __run_batch(cb, keys, lens, n, 0, __batch_max_insertions, results, NULL);
 }
 
 int counting_bloom_remove_string(CountingBloom* cb, const char* str) {
-    uint64_t* hashes = counting_bloom_calculate_hashes(cb, str, cb->number_hashes);
-    int r = counting_bloom_remove_string_alt(cb, hashes, cb->number_hashes);
-    free(hashes);
-    return r;
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(cb, str, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_remove_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_remove_bytes(CountingBloom* cb, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_remove_string_alt(cb, hashes, cb->number_hashes);
+}
+
+int counting_bloom_remove_u64(CountingBloom* cb, uint64_t key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    counting_bloom_calculate_hashes_u64_into(key, cb->number_hashes, hashes);
+    return counting_bloom_remove_string_alt(cb, hashes, cb->number_hashes);
 }
 
 int counting_bloom_remove_string_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed) {
-    if (counting_bloom_check_string_alt(cb, hashes, number_hashes_passed) == COUNTING_BLOOM_FAILURE) {
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    if (__check_counters(cb, indices) == COUNTING_BLOOM_FAILURE) {
         return COUNTING_BLOOM_FAILURE; // this means it isn't present; fail-quick
     }
-    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
-        uint64_t idx = hashes[i] % cb->number_bits;
-        if (cb->bloom[idx] != UINT32_MAX) {
-            --cb->bloom[idx];
-        }
+    __decrement_counters(cb, indices);
+    __change_elements_added(cb, -1);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_remove_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results) {
+    BatchUpdateState state;
+    state.cb = cb;
+    state.results = results;
+    state.changed = 0;
+    memset(results, 0, (n + 7) / 8);
+    int res = __run_batch(cb, keys, lens, n, 1, __batch_remove, &state, NULL);
+    __change_elements_added(cb, -(int64_t)state.changed);
+    return res;
+}
+
+int counting_bloom_calculate_indices(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed, uint64_t* indices) {
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return COUNTING_BLOOM_FAILURE;
     }
-    --cb->elements_added;
-    __update_elements_added_on_disk(cb);
+    __calculate_indices(cb, hashes, indices);
     return COUNTING_BLOOM_SUCCESS;
 }
 
 uint64_t* counting_bloom_calculate_hashes(const CountingBloom* cb, const char* str, unsigned int number_hashes) {
-    return cb->hash_function(number_hashes, str);
+    if (cb->hash_function_bytes == NULL && cb->hash_function_into == NULL && cb->hash_mode == COUNTING_BLOOM_HASH_SEEDED) {
+        return cb->hash_function(number_hashes, str);
+    }
+    uint64_t* results = (uint64_t*)calloc(number_hashes, sizeof(uint64_t));
+    if (results != NULL && counting_bloom_calculate_hashes_into(cb, str, number_hashes, results) == COUNTING_BLOOM_FAILURE) {
+        free(results);
+        results = NULL;
+    }
+    return results;
+}
+
+int counting_bloom_calculate_hashes_into(const CountingBloom* cb, const char* str, unsigned int number_hashes, uint64_t* results) {
+    return __calculate_hashes(cb, str, strlen(str), 1, number_hashes, results);
+}
+
+int counting_bloom_calculate_hashes_bytes_into(const CountingBloom* cb, const void* key, size_t len, unsigned int number_hashes, uint64_t* results) {
+    return __calculate_hashes(cb, key, len, 0, number_hashes, results);
+}
+
+void counting_bloom_calculate_hashes_u64_into(uint64_t key, unsigned int number_hashes, uint64_t* results) {
+    // two independent mixes of the key; the rest are derived using double hashing
+    uint64_t h1 = counting_bloom_mix_64(key + 0x9E3779B97F4A7C15ULL);
+    uint64_t h2 = counting_bloom_mix_64(key + 0x3C6EF372FE94F82AULL);
+    __double_hashes(h1, h2, number_hashes, results);
 }
 
 float counting_bloom_current_false_positive_rate(const CountingBloom* cb) {
-    int num = cb->number_hashes * cb->elements_added;
+    int num = cb->number_hashes * __get_elements_added(cb);
     double d = -num / (float) cb->number_bits;
     double e = exp(d);
     return pow((1 - e), cb->number_hashes);
@@ -233,33 +684,59 @@ int counting_bloom_export(const CountingBloom* cb, const char* filepath) {
     return COUNTING_BLOOM_SUCCESS;
 }
 
-int counting_bloom_import_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function) {
+int counting_bloom_import_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts) {
     FILE* fp;
     fp = fopen(filepath, "r+b");
     if (fp == NULL) {
         fprintf(stderr, "Can't open file %s!\n", filepath);
         return COUNTING_BLOOM_FAILURE;
     }
-    __read_from_file(cb, fp, 0, NULL);
+    int res = __read_from_file(cb, fp, 0, NULL);
     fclose(fp);
+    if (res == COUNTING_BLOOM_FAILURE) {
+        fprintf(stderr, "%s is not a valid counting bloom!\n", filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
     cb->__is_on_disk = 0;  // not on disk
-    cb->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    cb->filepointer = NULL;
+    __set_hash_functions(cb, opts);
+    __set_runtime_options(cb, opts);
     return COUNTING_BLOOM_SUCCESS;
 }
 
-int counting_bloom_import_on_disk_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function) {
+int counting_bloom_import_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_function = hash_function;
+    return counting_bloom_import_opts(cb, filepath, &opts);
+}
+
+int counting_bloom_import_on_disk_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts) {
     cb->filepointer = fopen(filepath, "r+b");
     if (cb->filepointer == NULL) {
         fprintf(stderr, "Can't open file %s!\n", filepath);
         return COUNTING_BLOOM_FAILURE;
     }
-    __read_from_file(cb, cb->filepointer, 1, filepath);
+    if (__read_from_file(cb, cb->filepointer, 1, filepath) == COUNTING_BLOOM_FAILURE) {
+        fprintf(stderr, "%s is not a valid counting bloom!\n", filepath);
+        fclose(cb->filepointer);
+        cb->filepointer = NULL;
+        return COUNTING_BLOOM_FAILURE;
+    }
     // don't close the file pointer here...
-    cb->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    __set_hash_functions(cb, opts);
+    __set_runtime_options(cb, opts);
     cb->__is_on_disk = 1; // on disk
     return COUNTING_BLOOM_SUCCESS;
 }
 
+int counting_bloom_import_on_disk_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_function = hash_function;
+    return counting_bloom_import_on_disk_opts(cb, filepath, &opts);
+}
+
 void counting_bloom_stats(const CountingBloom* cb) {
     const char* is_on_disk = (cb->__is_on_disk == 0 ? "no" : "yes");
     uint64_t largest, largest_index, calculated_elements;
@@ -282,111 +759,1296 @@ void counting_bloom_stats(const CountingBloom* cb) {
     max index id: %" PRIu64 "\n\
     calculated elements: %" PRIu64 "\n", // use this to make sure the numbers still match
     cb->number_bits, cb->estimated_elements, cb->number_hashes,
-    cb->false_positive_probability, cb->elements_added,
+    cb->false_positive_probability, __get_elements_added(cb),
     counting_bloom_current_false_positive_rate(cb), is_on_disk,
     fullness, largest, largest_index, calculated_elements);
 }
 
+int counting_bloom_merge(CountingBloom* cb, const CountingBloom* other) {
+    if (__same_parameters(cb, other) == 0) {
+        fprintf(stderr, "Unable to merge counting blooms with different parameters!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    __merge_counters(cb, other);
+    __change_elements_added(cb, (int64_t)__get_elements_added(other));
+    return COUNTING_BLOOM_SUCCESS;
+}
+
 uint64_t counting_bloom_count_set_bits(const CountingBloom* cb) {
     uint64_t res = 0;
     for (uint64_t i = 0; i < cb->number_bits; ++i) {
-        res += cb->bloom[i] > 0 ? 1 : 0;
+        res += __get_counter(cb, i) > 0 ? 1 : 0;
     }
     return res;
 }
 
+uint64_t counting_bloom_counter_bytes(const CountingBloom* cb) {
+    return __counter_bytes(cb);
+}
+
 uint64_t counting_bloom_export_size(const CountingBloom* cb) {
-    return (uint64_t)((cb->number_bits * sizeof(uint32_t)) + (2 * sizeof(uint32_t)) + sizeof(float));
+    uint64_t extension = __has_extension(cb) ? EXTENSION_SIZE : 0;
+    return (uint64_t)(__counter_bytes(cb) + (2 * sizeof(uint32_t)) + sizeof(float)) + extension;
 }
 
 
-/*******************************************************************************
-***		PRIVATE FUNCTIONS
-*******************************************************************************/
-static void __calculate_optimal_hashes(CountingBloom* cb) {
-    // calc optimized values
-    long n = cb->estimated_elements;
-    float p = cb->false_positive_probability;
-    uint64_t m = ceil((-n * log(p)) / LOG_TWO_SQUARED);  // AKA pow(log(2), 2);
-    unsigned int k = round(log(2.0) * m / n);
-    // set paramenters
-    cb->number_hashes = k; // should check to make sure it is at least 1...
-    cb->number_bits = m;
+int counting_bloom_deltas_init(CountingBloomDeltas* deltas, CountingBloom* cb, uint64_t capacity) {
+    if (capacity > COUNTING_BLOOM_MAX_DELTAS) {  // also keeps 2 * capacity, and the slots, from overflowing
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t slots = 16;
+    while (slots < 2 * capacity || slots < 4 * (uint64_t)cb->number_hashes) {
+        slots <<= 1;
+    }
+    deltas->slots = (CountingBloomDelta*)calloc(slots, sizeof(CountingBloomDelta));
+    if (deltas->slots == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    deltas->cb = cb;
+    deltas->capacity = slots;
+    deltas->used = 0;
+    deltas->elements_added = 0;
+    return COUNTING_BLOOM_SUCCESS;
 }
 
-/* NOTE: The caller will free the results */
-static uint64_t* __default_hash(int num_hashes, const char* str) {
-    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
-    int i;
-    for (i = 0; i < num_hashes; ++i) {
-        results[i] = __fnv_1a(str, i);
+int counting_bloom_deltas_destroy(CountingBloomDeltas* deltas) {
+    counting_bloom_deltas_flush(deltas);
+    free(deltas->slots);
+    deltas->cb = NULL;
+    deltas->slots = NULL;
+    deltas->capacity = 0;
+    deltas->used = 0;
+    deltas->elements_added = 0;
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_deltas_flush(CountingBloomDeltas* deltas) {
+    CountingBloom* cb = deltas->cb;
+    uint32_t max = __counter_max(cb);
+    for (uint64_t i = 0; i < deltas->capacity && deltas->used > 0; ++i) {
+        CountingBloomDelta* slot = &deltas->slots[i];
+        if (slot->index == 0) {
+            continue;
+        }
+        uint64_t idx = slot->index - 1;
+        if (cb->concurrent == 1) {
+            __atomic_update_counter(cb, idx, slot->delta, slot->peak);
+        } else {
+            __set_counter(cb, idx, __apply_delta(__get_counter(cb, idx), slot->delta, slot->peak, max));
+        }
+        slot->index = 0;
+        slot->delta = 0;
+        slot->peak = 0;
+        --deltas->used;
     }
-    return results;
+    if (deltas->elements_added != 0) {
+        __change_elements_added(cb, deltas->elements_added);
+        deltas->elements_added = 0;
+    }
+    return COUNTING_BLOOM_SUCCESS;
 }
 
-static uint64_t __fnv_1a(const char* key, int seed) {
-    // FNV-1a hash (http://www.isthe.com/chongo/tech/comp/fnv/)
-    int i, len = strlen(key);
-    uint64_t h = 14695981039346656037ULL + (31 * seed); // FNV_OFFSET 64 bit with magic number seed
-    for (i = 0; i < len; ++i){
-            h = h ^ (unsigned char) key[i];
-            h = h * 1099511628211ULL; // FNV_PRIME 64 bit
+int counting_bloom_deltas_add_string(CountingBloomDeltas* deltas, const char* key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(deltas->cb, key, deltas->cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
     }
-    return h;
+    return counting_bloom_deltas_add_alt(deltas, hashes, deltas->cb->number_hashes);
 }
 
-/* NOTE: this assumes that the file handler is open and ready to use */
-static void __write_to_file(const CountingBloom* cb, FILE* fp, short on_disk) {
-    if (on_disk == 0) {
-        fwrite(cb->bloom, sizeof(uint32_t), cb->number_bits, fp);
-    } else {
-        // will need to write out everything by hand
-        uint64_t i;
-        uint32_t q = 0;
-        for (i = 0; i < cb->number_bits; ++i) {
-            fwrite(&q, 1, sizeof(uint32_t), fp);
-        }
+int counting_bloom_deltas_add_bytes(CountingBloomDeltas* deltas, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(deltas->cb, key, len, deltas->cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
     }
-    fwrite(&cb->estimated_elements, sizeof(uint64_t), 1, fp);
-    fwrite(&cb->elements_added, sizeof(uint64_t), 1, fp);
-    fwrite(&cb->false_positive_probability, sizeof(float), 1, fp);
+    return counting_bloom_deltas_add_alt(deltas, hashes, deltas->cb->number_hashes);
 }
 
-/* NOTE: this assumes that the file handler is open and ready to use */
-static void __read_from_file(CountingBloom* cb, FILE* fp, short on_disk, const char* filename) {
-    int offset = sizeof(uint64_t) * 2 + sizeof(float);
-    fseek(fp, offset * -1, SEEK_END);
-    fread(&cb->estimated_elements, sizeof(uint64_t), 1, fp);
-    fread(&cb->elements_added, sizeof(uint64_t), 1, fp);
-    fread(&cb->false_positive_probability, sizeof(float), 1, fp);
-    __calculate_optimal_hashes(cb);
-    rewind(fp);
-    if(on_disk == 0) {
-        cb->bloom = (uint32_t*)calloc(cb->number_bits, sizeof(uint32_t));
-        fread(cb->bloom, sizeof(uint32_t), cb->number_bits, fp);
-    } else {  // this is for on disk implementation which isn't completed yet
-        struct stat buf;
-        int fd = open(filename, O_RDWR);
-        if (fd < 0) {
-            perror("open: ");
-            exit(1);
-        }
-        fstat(fd, &buf);
-        cb->__filesize = buf.st_size;
+int counting_bloom_deltas_add_alt(CountingBloomDeltas* deltas, const uint64_t* hashes, unsigned int number_hashes_passed) {
+    const CountingBloom* cb = deltas->cb;
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    __reserve_deltas(deltas);
+    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+        CountingBloomDelta* slot = __find_delta(deltas, indices[i], 1);
+        ++slot->delta;
+        slot->peak = (slot->delta > slot->peak) ? slot->delta : slot->peak;
+    }
+    ++deltas->elements_added;
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_deltas_remove_string(CountingBloomDeltas* deltas, const char* key) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_into(deltas->cb, key, deltas->cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_deltas_remove_alt(deltas, hashes, deltas->cb->number_hashes);
+}
+
+int counting_bloom_deltas_remove_bytes(CountingBloomDeltas* deltas, const void* key, size_t len) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    if (counting_bloom_calculate_hashes_bytes_into(deltas->cb, key, len, deltas->cb->number_hashes, hashes) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return counting_bloom_deltas_remove_alt(deltas, hashes, deltas->cb->number_hashes);
+}
+
+int counting_bloom_deltas_remove_alt(CountingBloomDeltas* deltas, const uint64_t* hashes, unsigned int number_hashes_passed) {
+    const CountingBloom* cb = deltas->cb;
+    if (number_hashes_passed < cb->number_hashes) {
+        fprintf(stderr, "Error: Not enough hashes were passed!\n");
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t indices[COUNTING_BLOOM_MAX_HASHES];
+    __calculate_indices(cb, hashes, indices);
+    __reserve_deltas(deltas);
+    uint32_t max = __counter_max(cb);
+    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+        uint32_t value = (cb->concurrent == 1) ? __atomic_get_counter(cb, indices[i]) : __get_counter(cb, indices[i]);
+        const CountingBloomDelta* slot = __find_delta(deltas, indices[i], 0);
+        if (slot != NULL) {
+            value = __apply_delta(value, slot->delta, slot->peak, max);
+        }
+        if (value == 0) {
+            return COUNTING_BLOOM_FAILURE; // this means it isn't present; fail-quick
+        }
+    }
+    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+        --__find_delta(deltas, indices[i], 1)->delta;
+    }
+    --deltas->elements_added;
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+/* Validate and set the parameters shared by the in memory and on disk initialization */
+static int __init_parameters(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts) {
+    if(estimated_elements == 0 || estimated_elements > UINT64_MAX) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if (false_positive_rate <= 0.0 || false_positive_rate >= 1.0 ) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    unsigned int width = (opts->counter_width == 0) ? 32 : opts->counter_width;
+    if (width != 4 && width != 8 && width != 16 && width != 32) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    cb->estimated_elements = estimated_elements;
+    cb->false_positive_probability = false_positive_rate;
+    cb->hash_mode = opts->hash_mode;
+    cb->index_mode = opts->index_mode;
+    cb->hash_type = opts->hash_type;
+    unsigned int block_size = 0;
+    if (opts->layout == COUNTING_BLOOM_LAYOUT_BLOCKED) {
+        block_size = COUNTING_BLOOM_CACHE_LINE_SIZE;
+    } else if (opts->layout == COUNTING_BLOOM_LAYOUT_PAGE_BLOCKED) {
+        block_size = (opts->block_size == 0) ? COUNTING_BLOOM_PAGE_SIZE : opts->block_size;
+        if (block_size < COUNTING_BLOOM_CACHE_LINE_SIZE || (block_size & (block_size - 1)) != 0 || block_size > (UINT32_MAX >> 3)) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+    }
+    cb->counter_width = width;
+    cb->block_size = block_size;
+    __calculate_optimal_hashes(cb);
+    return __check_layout(cb);
+}
+
+static void __calculate_optimal_hashes(CountingBloom* cb) {
+    // calc optimized values
+    long n = cb->estimated_elements;
+    float p = cb->false_positive_probability;
+    uint64_t m = ceil((-n * log(p)) / LOG_TWO_SQUARED);  // AKA pow(log(2), 2);
+    unsigned int k = round(log(2.0) * m / n);
+    uint64_t units = m, unit_counters = 1;
+    if (cb->block_size != 0) {
+        /*  Keys are not spread evenly over the blocks so more blocks are needed than
+            m / block_counters; search for the fewest that meet the false positive rate */
+        unit_counters = (cb->block_size * 8) / cb->counter_width;
+        uint64_t low = (m + unit_counters - 1) / unit_counters, high = low;
+        while (__blocked_false_positive_rate(n, high, unit_counters, k) > p && high < (UINT64_MAX >> 2) / unit_counters) {
+            low = high;
+            high *= 2;
+        }
+        while (low < high) {
+            uint64_t mid = low + (high - low) / 2;
+            if (__blocked_false_positive_rate(n, mid, unit_counters, k) > p) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        units = high;
+    }
+    if (cb->index_mode == COUNTING_BLOOM_INDEX_POWER_OF_TWO) {
+        uint64_t pow2 = 1;
+        while (pow2 < units) {
+            pow2 <<= 1;
+        }
+        units = pow2;
+    }
+    // set paramenters
+    cb->number_hashes = k; // should check to make sure it is at least 1...
+    cb->number_bits = units * unit_counters;
+    __update_block_layout(cb);
+}
+
+/*
+    False positive rate of a blocked bloom. The number of keys in a block follows a
+    Poisson distribution and, for each load, the number of set counters follows the
+    occupancy distribution of throwing k balls per key into the block's counters.
+    The usual (1 - e^(-kn/m))^k style estimate from the average load undercounts
+    false positives noticeably for blocks of only 16 to 128 counters; it is close
+    enough for page sized blocks where the exact distribution is too costly.
+*/
+static double __blocked_false_positive_rate(uint64_t estimated_elements, uint64_t number_blocks, unsigned int block_counters, unsigned int number_hashes) {
+    double lambda = (double)estimated_elements / number_blocks, fpr = 0.0;
+    uint64_t i, limit = (uint64_t)(lambda + 10 * sqrt(lambda) + 20);
+    if (block_counters > 256) {
+        // the load is far from zero for large blocks; skip the negligible low tail
+        uint64_t start = (lambda > 10 * sqrt(lambda) + 20) ? (uint64_t)(lambda - 10 * sqrt(lambda) - 20) : 0;
+        for (i = start; i <= limit; ++i) {
+            fpr += __poisson(lambda, i) * pow(1.0 - pow(1.0 - 1.0 / block_counters, (double)number_hashes * i), number_hashes);
+        }
+        return fpr;
+    }
+    double* occupied = (double*)calloc(block_counters + 1, sizeof(double));
+    if (occupied == NULL) {
+        return 0.0;
+    }
+    occupied[0] = 1.0;
+    for (i = 0; i <= limit; ++i) {
+        // probability that all k counters of a new key are already set with i keys in the block
+        double block_fpr = 0.0;
+        for (unsigned int x = 1; x <= block_counters; ++x) {
+            block_fpr += occupied[x] * pow((double)x / block_counters, number_hashes);
+        }
+        fpr += __poisson(lambda, i) * block_fpr;
+        // add the next key's counters to the occupancy distribution
+        for (unsigned int j = 0; j < number_hashes; ++j) {
+            for (unsigned int x = block_counters; x > 0; --x) {
+                occupied[x] = occupied[x] * x / block_counters + occupied[x - 1] * (block_counters - x + 1) / block_counters;
+            }
+            occupied[0] = 0.0;
+        }
+    }
+    free(occupied);
+    return fpr;
+}
+
+/* computed in log space so large block loads do not underflow */
+static __inline__ double __poisson(double lambda, uint64_t i) {
+    return exp(i * log(lambda) - lambda - lgamma(i + 1.0));
+}
+
+static void __update_block_layout(CountingBloom* cb) {
+    if (cb->block_size == 0) {
+        cb->__block_counters = 0;
+        cb->__block_shift = 0;
+        cb->__number_blocks = 0;
+    } else {
+        cb->__block_counters = (cb->block_size * 8) / cb->counter_width;
+        cb->__block_shift = 64;
+        for (unsigned int i = cb->__block_counters; i > 1; i >>= 1) {
+            --cb->__block_shift;
+        }
+        cb->__number_blocks = cb->number_bits / cb->__block_counters;
+    }
+}
+
+/* Blocked counters are aligned to the block size so a block is never split */
+static uint32_t* __allocate_counters(const CountingBloom* cb) {
+    uint64_t bytes = __counter_bytes(cb);
+    if (cb->block_size == 0) {
+        return (uint32_t*)calloc(bytes, 1);
+    }
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, cb->block_size, bytes) != 0) {
+        return NULL;
+    }
+    memset(ptr, 0, bytes);
+    return (uint32_t*)ptr;
+}
+
+/* Number of bytes used to store the counters; 4 bit counters are packed two per byte */
+static __inline__ uint64_t __counter_bytes(const CountingBloom* cb) {
+    if (cb->counter_width == 4) {
+        return (cb->number_bits + 1) / 2;
+    }
+    return cb->number_bits * (cb->counter_width / 8);
+}
+
+static __inline__ uint32_t __counter_max(const CountingBloom* cb) {
+    return (cb->counter_width == 32) ? UINT32_MAX : (1U << cb->counter_width) - 1;
+}
+
+static __inline__ uint32_t __get_counter(const CountingBloom* cb, uint64_t idx) {
+    switch (cb->counter_width) {
+        case 4:
+            return (((const uint8_t*)cb->bloom)[idx >> 1] >> ((idx & 1) << 2)) & 0x0F;
+        case 8:
+            return ((const uint8_t*)cb->bloom)[idx];
+        case 16:
+            return ((const uint16_t*)cb->bloom)[idx];
+        default:
+            return cb->bloom[idx];
+    }
+}
+
+static __inline__ void __set_counter(CountingBloom* cb, uint64_t idx, uint32_t value) {
+    switch (cb->counter_width) {
+        case 4: {
+            uint8_t* byte = &((uint8_t*)cb->bloom)[idx >> 1];
+            unsigned int shift = (idx & 1) << 2;
+            *byte = (uint8_t)((*byte & ~(0x0F << shift)) | (value << shift));
+            break;
+        }
+        case 8:
+            ((uint8_t*)cb->bloom)[idx] = (uint8_t)value;
+            break;
+        case 16:
+            ((uint16_t*)cb->bloom)[idx] = (uint16_t)value;
+            break;
+        default:
+            cb->bloom[idx] = value;
+            break;
+    }
+}
+
+/*
+    Saturating add of the other counters into cb, 16 bytes at a time with SSE2 (part
+    of the x86-64 baseline so no dispatch is needed) and element by element for the
+    remainder. 4 bit counters add the high nibbles in place, where the byte wise
+    saturation at 0xFF still leaves 0xF, and the low nibbles with a min against 0xF.
+*/
+static void __merge_counters(CountingBloom* cb, const CountingBloom* other) {
+    uint8_t* dst = (uint8_t*)cb->bloom;
+    const uint8_t* src = (const uint8_t*)other->bloom;
+    uint64_t bytes = __counter_bytes(cb), i = 0;
+#ifdef COUNTING_BLOOM_X86_64
+    const __m128i low = _mm_set1_epi8(0x0F), high = _mm_set1_epi8((char)0xF0);
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i res;
+        switch (cb->counter_width) {
+            case 4:
+                res = _mm_or_si128(
+                    _mm_and_si128(_mm_adds_epu8(_mm_and_si128(a, high), _mm_and_si128(b, high)), high),
+                    _mm_min_epu8(_mm_add_epi8(_mm_and_si128(a, low), _mm_and_si128(b, low)), low));
+                break;
+            case 8:
+                res = _mm_adds_epu8(a, b);
+                break;
+            case 16:
+                res = _mm_adds_epu16(a, b);
+                break;
+            default: {
+                // unsigned overflow (sum < a) as a signed compare of the biased values
+                __m128i sum = _mm_add_epi32(a, b);
+                __m128i overflow = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(sum, bias));
+                res = _mm_or_si128(sum, overflow);
+                break;
+            }
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), res);
+    }
+#endif
+    uint32_t max = __counter_max(cb);
+    for (uint64_t idx = i * 8 / cb->counter_width; idx < cb->number_bits; ++idx) {
+        uint64_t sum = (uint64_t)__get_counter(cb, idx) + __get_counter(other, idx);
+        __set_counter(cb, idx, (sum > max) ? max : (uint32_t)sum);
+    }
+}
+
+/*
+    Reduce the hashes to counter indices. In the blocked layout the block comes from
+    a remix of the first hash (every index mode reduces it over the blocks) and each
+    counter from the top bits of its remixed hash; FNV-1a's raw bits and double
+    hashing's arithmetic progression are both too weak to use directly.
+*/
+static __inline__ void __calculate_indices(const CountingBloom* cb, const uint64_t* hashes, uint64_t* indices) {
+    unsigned int i;
+    if (cb->block_size == 0) {
+        /*  fastrange uses only the high bits of the hash, which FNV-1a does not mix well
+            for short keys; remix them (hash functions passed in also report FNV_1A) */
+        if (cb->index_mode == COUNTING_BLOOM_INDEX_FASTRANGE && cb->hash_type == COUNTING_BLOOM_HASH_TYPE_FNV_1A) {
+            for (i = 0; i < cb->number_hashes; ++i) {
+                indices[i] = __mul_hi_64(counting_bloom_mix_64(hashes[i]), cb->number_bits);
+            }
+            return;
+        }
+        for (i = 0; i < cb->number_hashes; ++i) {
+            indices[i] = __reduce(cb, hashes[i], cb->number_bits);
+        }
+        return;
+    }
+    uint64_t base = __reduce(cb, counting_bloom_mix_64(hashes[0]), cb->__number_blocks) * cb->__block_counters;
+    for (i = 0; i < cb->number_hashes; ++i) {
+        uint64_t h = (hashes[i] ^ (hashes[i] >> 32)) * 0x9E3779B97F4A7C15ULL;
+        indices[i] = base + (h >> cb->__block_shift);
+    }
+}
+
+static __inline__ void __increment_counters(CountingBloom* cb, const uint64_t* indices, uint64_t n) {
+    if (cb->concurrent == 1) {
+        for (uint64_t i = 0; i < n; ++i) {
+            __atomic_update_counter(cb, indices[i], 1, 1);
+        }
+        return;
+    }
+    uint32_t max = __counter_max(cb);
+    for (uint64_t i = 0; i < n; ++i) {
+        uint32_t value = __get_counter(cb, indices[i]);
+        if (value < max) {
+            __set_counter(cb, indices[i], value + 1);
+        }
+    }
+}
+
+/* Saturated counters are sticky since the true count is unknown */
+static __inline__ void __decrement_counters(CountingBloom* cb, const uint64_t* indices) {
+    if (cb->concurrent == 1) {
+        for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+            __atomic_update_counter(cb, indices[i], -1, 0);
+        }
+        return;
+    }
+    uint32_t max = __counter_max(cb);
+    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+        uint32_t value = __get_counter(cb, indices[i]);
+        if (value != max) {
+            __set_counter(cb, indices[i], value - 1);
+        }
+    }
+}
+
+static __inline__ int __check_counters(const CountingBloom* cb, const uint64_t* indices) {
+    return (__min_counter(cb, indices) == 0) ? COUNTING_BLOOM_FAILURE : COUNTING_BLOOM_SUCCESS;
+}
+
+static __inline__ uint32_t __min_counter(const CountingBloom* cb, const uint64_t* indices) {
+    if (cb->concurrent == 1) {
+        uint32_t res = UINT32_MAX;
+        for (unsigned int i = 0; i < cb->number_hashes && res != 0; ++i) {
+            uint32_t value = __atomic_get_counter(cb, indices[i]);
+            if (value < res) {
+                res = value;
+            }
+        }
+        return res;
+    }
+    if (cb->counter_width == 32) {
+        return cb->__probe_32(cb->bloom, indices, cb->number_hashes);
+    }
+    uint32_t res = UINT32_MAX; // set this to the max and work down
+    for (unsigned int i = 0; i < cb->number_hashes && res != 0; ++i) {
+        uint32_t value = __get_counter(cb, indices[i]);
+        if (value < res) {
+            res = value;
+        }
+    }
+    return res;
+}
+
+static uint32_t __probe_32(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes) {
+    uint32_t res = UINT32_MAX;
+    for (unsigned int i = 0; i < number_hashes && res != 0; ++i) {
+        if (counters[indices[i]] < res) {
+            res = counters[indices[i]];
+        }
+    }
+    return res;
+}
+
+#ifdef COUNTING_BLOOM_X86_64
+/* Gather 4 counters at a time; a zero in any group ends the probe like the scalar loop */
+__attribute__((target("avx2")))
+static uint32_t __probe_32_avx2(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i res = _mm_set1_epi32(-1);
+    unsigned int i = 0;
+    for (; i + 4 <= number_hashes; i += 4) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)(indices + i));
+        __m128i values = _mm256_i64gather_epi32((const int*)counters, idx, 4);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(values, zero)) != 0) {
+            return 0;
+        }
+        res = _mm_min_epu32(res, values);
+    }
+    res = _mm_min_epu32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(1, 0, 3, 2)));
+    res = _mm_min_epu32(res, _mm_shuffle_epi32(res, _MM_SHUFFLE(2, 3, 0, 1)));
+    uint32_t min = (uint32_t)_mm_cvtsi128_si32(res);
+    for (; i < number_hashes && min != 0; ++i) {
+        if (counters[indices[i]] < min) {
+            min = counters[indices[i]];
+        }
+    }
+    return min;
+}
+
+/* Gather 8 counters at a time; the remainder uses a masked gather so nothing past k is read */
+__attribute__((target("avx512f")))
+static uint32_t __probe_32_avx512(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i res = ones;
+    for (unsigned int i = 0; i < number_hashes; i += 8) {
+        __mmask8 mask = (number_hashes - i >= 8) ? 0xFF : (__mmask8)((1u << (number_hashes - i)) - 1);
+        __m512i idx = _mm512_maskz_loadu_epi64(mask, indices + i);
+        __m256i values = _mm512_mask_i64gather_epi32(ones, mask, idx, counters, 4);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(values, _mm256_setzero_si256())) != 0) {
+            return 0;
+        }
+        res = _mm256_min_epu32(res, values);
+    }
+    __m128i min = _mm_min_epu32(_mm256_castsi256_si128(res), _mm256_extracti128_si256(res, 1));
+    min = _mm_min_epu32(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+    min = _mm_min_epu32(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(min);
+}
+#endif
+
+/* Options that are not stored in the file */
+static void __set_runtime_options(CountingBloom* cb, const CountingBloomOptions* opts) {
+    cb->concurrent = (opts->concurrent != 0) ? 1 : 0;
+    cb->__mapping = NULL;  // set after this for shared memory
+    cb->__shared_elements_added = NULL;
+    cb->__probe_32 = __probe_32;
+#ifdef COUNTING_BLOOM_X86_64
+    CountingBloomProbe probe = opts->probe;
+    if (probe == COUNTING_BLOOM_PROBE_AUTO) {
+        probe = __builtin_cpu_supports("avx512f") ? COUNTING_BLOOM_PROBE_AVX512 : COUNTING_BLOOM_PROBE_AVX2;
+    }
+    if (probe == COUNTING_BLOOM_PROBE_AVX512 && __builtin_cpu_supports("avx512f")) {
+        cb->__probe_32 = __probe_32_avx512;
+    } else if (probe == COUNTING_BLOOM_PROBE_AVX2 && __builtin_cpu_supports("avx2")) {
+        cb->__probe_32 = __probe_32_avx2;
+    }
+#else
+    (void)opts;
+#endif
+}
+
+static __inline__ void __prefetch_counters(const CountingBloom* cb, const uint64_t* indices, short for_write) {
+#if defined(__GNUC__)
+    const char* base = (const char*)cb->bloom;
+    for (unsigned int i = 0; i < cb->number_hashes; ++i) {
+        const char* addr = base + ((cb->counter_width == 4) ? indices[i] / 2 : indices[i] * (cb->counter_width / 8));
+        if (for_write) {
+            __builtin_prefetch(addr, 1);
+        } else {
+            __builtin_prefetch(addr, 0);
+        }
+    }
+#else
+    (void)cb;
+    (void)indices;
+    (void)for_write;
+#endif
+}
+
+/* Hash the i-th key of a batch into its counter indices and start loading those counters */
+static int __batch_indices(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t i, uint64_t* indices, short for_write) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    int res;
+    if (lens == NULL) {
+        res = __calculate_hashes(cb, keys[i], strlen(keys[i]), 1, cb->number_hashes, hashes);
+    } else {
+        res = __calculate_hashes(cb, keys[i], lens[i], 0, cb->number_hashes, hashes);
+    }
+    if (res == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    __calculate_indices(cb, hashes, indices);
+    __prefetch_counters(cb, indices, for_write);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/*
+    Hash the keys a window ahead of the key passed to fn so that the loads of several
+    keys' counters are in flight at once. If hashing a key fails, the keys before it
+    are still processed; processed (if not NULL) is set to the number of keys passed
+    to fn.
+*/
+static int __run_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, short for_write, BatchFunction fn, void* state, uint64_t* processed) {
+    uint64_t* window = (uint64_t*)malloc(BATCH_WINDOW * cb->number_hashes * sizeof(uint64_t));
+    if (window == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    int res = COUNTING_BLOOM_SUCCESS;
+    uint64_t hashed = 0, done = 0;
+    while (done < n) {
+        for (; hashed < n && hashed < done + BATCH_WINDOW; ++hashed) {
+            if (__batch_indices(cb, keys, lens, hashed, window + (hashed % BATCH_WINDOW) * cb->number_hashes, for_write) == COUNTING_BLOOM_FAILURE) {
+                n = hashed;
+                res = COUNTING_BLOOM_FAILURE;
+                break;
+            }
+        }
+        if (done < n) {
+            fn(cb, window + (done % BATCH_WINDOW) * cb->number_hashes, done, state);
+            ++done;
+        }
+    }
+    free(window);
+    if (processed != NULL) {
+        *processed = done;
+    }
+    return res;
+}
+
+static void __batch_add(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state) {
+    (void)cb;
+    (void)i;
+    __increment_counters((CountingBloom*)state, indices, cb->number_hashes);
+}
+
+static void __batch_check(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state) {
+    if (__check_counters(cb, indices) == COUNTING_BLOOM_SUCCESS) {
+        ((uint8_t*)state)[i / 8] |= (uint8_t)(1 << (i % 8));
+    }
+}
+
+static void __batch_max_insertions(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state) {
+    ((uint32_t*)state)[i] = __min_counter(cb, indices);
+}
+
+/* Keys are removed in order so a key repeated in the batch is removed once per occurrence */
+static void __batch_remove(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state) {
+    BatchUpdateState* us = (BatchUpdateState*)state;
+    if (__check_counters(cb, indices) == COUNTING_BLOOM_SUCCESS) {
+        __decrement_counters(us->cb, indices);
+        us->results[i / 8] |= (uint8_t)(1 << (i % 8));
+        ++us->changed;
+    }
+}
+
+/* Keys are added in order so a key repeated in the batch is present after its first occurrence */
+static void __batch_check_and_add(const CountingBloom* cb, const uint64_t* indices, uint64_t i, void* state) {
+    BatchUpdateState* us = (BatchUpdateState*)state;
+    if (__check_counters(cb, indices) == COUNTING_BLOOM_SUCCESS) {
+        us->results[i / 8] |= (uint8_t)(1 << (i % 8));
+    } else {
+        __increment_counters(us->cb, indices, cb->number_hashes);
+        ++us->changed;
+    }
+}
+
+/* Reduce a hash to [0, range) based on the index mode */
+static __inline__ uint64_t __reduce(const CountingBloom* cb, uint64_t hash, uint64_t range) {
+    switch (cb->index_mode) {
+        case COUNTING_BLOOM_INDEX_FASTRANGE:
+            return __mul_hi_64(hash, range);
+        case COUNTING_BLOOM_INDEX_POWER_OF_TWO:
+            return hash & (range - 1);
+        default:
+            return hash % range;
+    }
+}
+
+/* High 64 bits of the 128 bit product (https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/) */
+static __inline__ uint64_t __mul_hi_64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128_t;
+    return (uint64_t)(((uint128_t)a * b) >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+static void __set_hash_functions(CountingBloom* cb, const CountingBloomOptions* opts) {
+    cb->hash_function = opts->hash_function;
+    cb->hash_function_into = opts->hash_function_into;
+    cb->hash_function_bytes = opts->hash_function_bytes;
+    if (cb->hash_function != NULL || cb->hash_function_into != NULL || cb->hash_function_bytes != NULL) {
+        return;
+    }
+    switch (cb->hash_type) {
+        case COUNTING_BLOOM_HASH_TYPE_WYHASH:
+            cb->hash_function_bytes = __wyhash_hash_bytes;
+            break;
+        case COUNTING_BLOOM_HASH_TYPE_CRC32C:
+            cb->hash_function_bytes = __crc32c_hash_bytes;
+#ifdef COUNTING_BLOOM_X86_64
+            if (__builtin_cpu_supports("sse4.2")) {
+                cb->hash_function_bytes = __crc32c_hash_bytes_sse42;
+            }
+#endif
+            break;
+        default:
+            cb->hash_function = __default_hash;
+            cb->hash_function_into = __default_hash_into;
+            cb->hash_function_bytes = __default_hash_bytes;
+            break;
+    }
+}
+
+/* Generate the hashes based on the hashing mode */
+static int __calculate_hashes(const CountingBloom* cb, const void* key, size_t len, short is_string, unsigned int number_hashes, uint64_t* results) {
+    if (cb->hash_mode == COUNTING_BLOOM_HASH_DOUBLE) {
+        uint64_t base[2];
+        if (__calculate_hashes_with_function(cb, key, len, is_string, 2, base) == COUNTING_BLOOM_FAILURE) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+        __double_hashes(base[0], base[1], number_hashes, results);
+        return COUNTING_BLOOM_SUCCESS;
+    }
+    return __calculate_hashes_with_function(cb, key, len, is_string, number_hashes, results);
+}
+
+static int __calculate_hashes_with_function(const CountingBloom* cb, const void* key, size_t len, short is_string, unsigned int number_hashes, uint64_t* results) {
+    if (cb->hash_function_bytes != NULL) {
+        cb->hash_function_bytes(number_hashes, key, len, results);
+        return COUNTING_BLOOM_SUCCESS;
+    }
+    if (is_string == 1) {
+        return __calculate_hashes_string(cb, (const char*)key, number_hashes, results);
+    }
+    // string hash functions need a NUL terminated copy of the key
+    char buffer[256];
+    char* str = (len < sizeof(buffer)) ? buffer : (char*)malloc(len + 1);
+    if (str == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    memcpy(str, key, len);
+    str[len] = '\0';
+    int r = __calculate_hashes_string(cb, str, number_hashes, results);
+    if (str != buffer) {
+        free(str);
+    }
+    return r;
+}
+
+static int __calculate_hashes_string(const CountingBloom* cb, const char* str, unsigned int number_hashes, uint64_t* results) {
+    if (cb->hash_function_into != NULL) {
+        cb->hash_function_into(number_hashes, str, results);
+        return COUNTING_BLOOM_SUCCESS;
+    }
+    // adapter for hash functions that return an allocated array
+    uint64_t* hashes = cb->hash_function(number_hashes, str);
+    if (hashes == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    memcpy(results, hashes, number_hashes * sizeof(uint64_t));
+    free(hashes);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/* NOTE: The caller will free the results */
+static uint64_t* __default_hash(int num_hashes, const char* str) {
+    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
+    if (results != NULL) {
+        __default_hash_into(num_hashes, str, results);
+    }
+    return results;
+}
+
+static void __default_hash_into(int num_hashes, const char* str, uint64_t* results) {
+    __fnv_1a_seeded((const unsigned char*)str, strlen(str), num_hashes, results);
+}
+
+static void __default_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results) {
+    __fnv_1a_seeded((const unsigned char*)key, len, num_hashes, results);
+}
+
+static __inline__ void __double_hashes(uint64_t h1, uint64_t h2, unsigned int number_hashes, uint64_t* results) {
+    for (unsigned int i = 0; i < number_hashes; ++i) {
+        results[i] = h1 + i * h2;
+    }
+}
+
+/*
+    FNV-1a hash (http://www.isthe.com/chongo/tech/comp/fnv/) using the seeds 0 to
+    num_hashes - 1. The seeded hashes only differ in the offset basis so they are
+    computed together, FNV_LANES at a time for each byte; this gives independent
+    multiply chains for the CPU to overlap instead of re-walking the key for each
+    seed. Up to COUNTING_BLOOM_MAX_HASHES seeds take a single pass over the key;
+    more are computed in chunks of that many, one pass per chunk.
+*/
+#define FNV_LANES 8
+static void __fnv_1a_seeded(const unsigned char* key, size_t len, int num_hashes, uint64_t* results) {
+    uint64_t h[COUNTING_BLOOM_MAX_HASHES];  // lanes past num_hashes are computed and dropped
+    int base, seed, l;
+    size_t i;
+    for (base = 0; base < num_hashes; base += COUNTING_BLOOM_MAX_HASHES) {
+        int count = (num_hashes - base < COUNTING_BLOOM_MAX_HASHES) ? num_hashes - base : COUNTING_BLOOM_MAX_HASHES;
+        int lanes = (count + FNV_LANES - 1) / FNV_LANES * FNV_LANES;
+        for (l = 0; l < lanes; ++l) {
+            h[l] = 14695981039346656037ULL + (31 * (base + l)); // FNV_OFFSET 64 bit with magic number seed
+        }
+        if (lanes == FNV_LANES) {  // the common case; a fixed number of lanes stays in registers
+            for (i = 0; i < len; ++i) {
+                for (l = 0; l < FNV_LANES; ++l) {
+                    h[l] = (h[l] ^ key[i]) * 1099511628211ULL; // FNV_PRIME 64 bit
+                }
+            }
+        } else {
+            for (i = 0; i < len; ++i) {
+                for (seed = 0; seed < lanes; seed += FNV_LANES) {
+                    for (l = seed; l < seed + FNV_LANES; ++l) {
+                        h[l] = (h[l] ^ key[i]) * 1099511628211ULL;
+                    }
+                }
+            }
+        }
+        memcpy(results + base, h, count * sizeof(uint64_t));
+    }
+}
+#undef FNV_LANES
+
+/*******************************************************************************
+***		BUILT-IN HASHES
+***
+***	Values are read as little endian so that the hashes (and therefore the
+***	exported files) are the same on every platform.
+*******************************************************************************/
+static __inline__ uint64_t __read_64(const unsigned char* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static __inline__ uint64_t __read_32(const unsigned char* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24);
+}
+
+/* wyhash (https://github.com/wangyi-fudan/wyhash) based on the final version 4 */
+static const uint64_t WYHASH_SECRET[4] = {0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+
+static __inline__ uint64_t __wymix(uint64_t a, uint64_t b) {
+    return (a * b) ^ __mul_hi_64(a, b);
+}
+
+static uint64_t __wyhash(const unsigned char* p, size_t len, uint64_t seed) {
+    uint64_t a, b;
+    seed ^= __wymix(seed ^ WYHASH_SECRET[0], WYHASH_SECRET[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (__read_32(p) << 32) | __read_32(p + ((len >> 3) << 2));
+            b = (__read_32(p + len - 4) << 32) | __read_32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = __wymix(__read_64(p) ^ WYHASH_SECRET[1], __read_64(p + 8) ^ seed);
+                see1 = __wymix(__read_64(p + 16) ^ WYHASH_SECRET[2], __read_64(p + 24) ^ see1);
+                see2 = __wymix(__read_64(p + 32) ^ WYHASH_SECRET[3], __read_64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = __wymix(__read_64(p) ^ WYHASH_SECRET[1], __read_64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = __read_64(p + i - 16);
+        b = __read_64(p + i - 8);
+    }
+    a ^= WYHASH_SECRET[1];
+    b ^= seed;
+    uint64_t lo = a * b, hi = __mul_hi_64(a, b);
+    return __wymix(lo ^ WYHASH_SECRET[0] ^ len, hi ^ WYHASH_SECRET[1]);
+}
+
+static void __wyhash_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results) {
+    uint64_t h1 = __wyhash((const unsigned char*)key, len, 0);
+    __double_hashes(h1, counting_bloom_mix_64(h1), num_hashes, results);
+}
+
+/*
+    CRC32C (Castagnoli) based hash. Two CRCs are run over alternating 8 byte words
+    to get 64 bits from the key; the CRCs are then mixed as CRC is linear. The
+    software and SSE4.2 versions produce the same values.
+*/
+static const uint32_t CRC32C_TABLE[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C,
+    0x26A1E7E8, 0xD4CA64EB, 0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+    0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24, 0x105EC76F, 0xE235446C,
+    0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC,
+    0xBC267848, 0x4E4DFB4B, 0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+    0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35, 0xAA64D611, 0x580F5512,
+    0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD,
+    0x1642AE59, 0xE4292D5A, 0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+    0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595, 0x417B1DBC, 0xB3109EBF,
+    0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F,
+    0xED03A29B, 0x1F682198, 0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+    0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38, 0xDBFC821C, 0x2997011F,
+    0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E,
+    0x4767748A, 0xB50CF789, 0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+    0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46, 0x7198540D, 0x83F3D70E,
+    0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE,
+    0xDDE0EB2A, 0x2F8B6829, 0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+    0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93, 0x082F63B7, 0xFA44E0B4,
+    0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B,
+    0xB4091BFF, 0x466298FC, 0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+    0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033, 0xA24BB5A6, 0x502036A5,
+    0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975,
+    0x0E330A81, 0xFC588982, 0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+    0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622, 0x38CC2A06, 0xCAA7A905,
+    0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8,
+    0xE52CC12C, 0x1747422F, 0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+    0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0, 0xD3D3E1AB, 0x21B862A8,
+    0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78,
+    0x7FAB5E8C, 0x8DC0DD8F, 0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+    0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1, 0x69E9F0D5, 0x9B8273D6,
+    0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69,
+    0xD5CF889D, 0x27A40B9E, 0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+    0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351
+};
+
+static __inline__ uint32_t __crc32c_u8(uint32_t crc, unsigned char v) {
+    return CRC32C_TABLE[(crc ^ v) & 0xFF] ^ (crc >> 8);
+}
+
+static __inline__ uint32_t __crc32c_u64(uint32_t crc, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        crc = __crc32c_u8(crc, (unsigned char)(v >> (i * 8)));
+    }
+    return crc;
+}
+
+static __inline__ void __crc32c_finalize(uint32_t a, uint32_t b, size_t len, int num_hashes, uint64_t* results) {
+    uint64_t h1 = counting_bloom_mix_64((((uint64_t)a << 32) | b) + len);
+    __double_hashes(h1, counting_bloom_mix_64(h1), num_hashes, results);
+}
+
+static void __crc32c_hash_bytes(int num_hashes, const void* key, size_t len, uint64_t* results) {
+    const unsigned char* p = (const unsigned char*)key;
+    uint32_t a = 0xFFFFFFFF, b = 0x0F0F0F0F;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        a = __crc32c_u64(a, __read_64(p + i));
+        b = __crc32c_u64(b, __read_64(p + i + 8));
+    }
+    if (i + 8 <= len) {
+        a = __crc32c_u64(a, __read_64(p + i));
+        i += 8;
+    }
+    for (; i < len; ++i) {
+        b = __crc32c_u8(b, p[i]);
+    }
+    __crc32c_finalize(a, b, len, num_hashes, results);
+}
+
+#ifdef COUNTING_BLOOM_X86_64
+__attribute__((target("sse4.2")))
+static void __crc32c_hash_bytes_sse42(int num_hashes, const void* key, size_t len, uint64_t* results) {
+    const unsigned char* p = (const unsigned char*)key;
+    uint64_t a = 0xFFFFFFFF, b = 0x0F0F0F0F;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        a = _mm_crc32_u64(a, __read_64(p + i));
+        b = _mm_crc32_u64(b, __read_64(p + i + 8));
+    }
+    if (i + 8 <= len) {
+        a = _mm_crc32_u64(a, __read_64(p + i));
+        i += 8;
+    }
+    for (; i < len; ++i) {
+        b = _mm_crc32_u8((uint32_t)b, p[i]);
+    }
+    __crc32c_finalize((uint32_t)a, (uint32_t)b, len, num_hashes, results);
+}
+#endif
+
+/* NOTE: this assumes that the file handler is open and ready to use */
+static int __write_to_file(const CountingBloom* cb, FILE* fp, short on_disk) {
+    if (on_disk == 0) {
+        fwrite(cb->bloom, 1, __counter_bytes(cb), fp);
+    } else if (ftruncate(fileno(fp), (off_t)__counter_bytes(cb)) != 0 || fseek(fp, 0, SEEK_END) != 0) {
+        // extending the new file zero fills the counters without writing them (sparse)
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if (__has_extension(cb)) {
+        __write_extension(cb, fp);
+    }
+    uint64_t elements_added = __get_elements_added(cb);
+    fwrite(&cb->estimated_elements, sizeof(uint64_t), 1, fp);
+    fwrite(&elements_added, sizeof(uint64_t), 1, fp);
+    fwrite(&cb->false_positive_probability, sizeof(float), 1, fp);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/* NOTE: this assumes that the file handler is open and ready to use */
+static int __read_from_file(CountingBloom* cb, FILE* fp, short on_disk, const char* filename) {
+    fseek(fp, 0, SEEK_END);
+    long filesize = ftell(fp);
+    if (filesize < TRAILER_SIZE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    fseek(fp, TRAILER_SIZE * -1, SEEK_END);
+    fread(&cb->estimated_elements, sizeof(uint64_t), 1, fp);
+    fread(&cb->elements_added, sizeof(uint64_t), 1, fp);
+    fread(&cb->false_positive_probability, sizeof(float), 1, fp);
+    if (cb->estimated_elements == 0 || !(cb->false_positive_probability > 0.0 && cb->false_positive_probability < 1.0)) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    cb->hash_mode = COUNTING_BLOOM_HASH_SEEDED;
+    cb->index_mode = COUNTING_BLOOM_INDEX_MODULO;
+    cb->hash_type = COUNTING_BLOOM_HASH_TYPE_FNV_1A;
+    cb->counter_width = 32;
+    cb->block_size = 0;
+    __calculate_optimal_hashes(cb);
+    long extension = __read_extension(cb, fp);
+    // the fields are checked before they are used for anything, including the size
+    if (__check_layout(cb) == COUNTING_BLOOM_FAILURE || (uint64_t)filesize != __counter_bytes(cb) + extension + TRAILER_SIZE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    __update_block_layout(cb);
+    rewind(fp);
+    if(on_disk == 0) {
+        cb->bloom = __allocate_counters(cb);
+        if (cb->bloom == NULL) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+        fread(cb->bloom, 1, __counter_bytes(cb), fp);
+    } else {  // this is for on disk implementation which isn't completed yet
+        int fd = open(filename, O_RDWR);
+        if (fd < 0) {
+            perror("open: ");
+            return COUNTING_BLOOM_FAILURE;
+        }
+        cb->__filesize = filesize;
         cb->bloom = (uint32_t*)mmap((caddr_t)0, cb->__filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // close the file descriptor
+        close(fd);
         if (cb->bloom == (uint32_t*)-1) {
             perror("mmap: ");
-            exit(1);
+            cb->bloom = NULL;
+            return COUNTING_BLOOM_FAILURE;
         }
-        // close the file descriptor
-        close(fd);
     }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+static int __has_extension(const CountingBloom* cb) {
+    return cb->hash_mode != COUNTING_BLOOM_HASH_SEEDED || cb->index_mode != COUNTING_BLOOM_INDEX_MODULO ||
+           cb->hash_type != COUNTING_BLOOM_HASH_TYPE_FNV_1A || cb->counter_width != 32 || cb->block_size != 0;
+}
+
+/* NOTE: this assumes that the file handler is positioned at the end of the counters */
+static void __write_extension(const CountingBloom* cb, FILE* fp) {
+    uint32_t fields[EXT_FIELD_COUNT];
+    __get_fields(cb, fields);
+    fwrite(&cb->number_bits, sizeof(uint64_t), 1, fp);
+    fwrite(fields, sizeof(uint32_t), EXT_FIELD_COUNT, fp);
+    fwrite(&EXTENSION_SIZE, sizeof(uint32_t), 1, fp);
+    fwrite(&EXTENSION_MAGIC, sizeof(uint32_t), 1, fp);
+}
+
+/*
+    Read the extension block, if there is one, overriding the calculated parameters.
+    The length and magic number are checked first since an extended file can be the
+    same size as a legacy one; files without them must be exactly the size of the
+    calculated counters and the trailer.
+*/
+/* Returns the length of the extension block; 0 if there is none */
+static long __read_extension(CountingBloom* cb, FILE* fp) {
+    fseek(fp, 0, SEEK_END);
+    long filesize = ftell(fp);
+    uint32_t length = 0, magic = 0;
+    if (filesize < (long)(TRAILER_SIZE + 2 * sizeof(uint32_t))) {
+        return 0;
+    }
+    fseek(fp, (TRAILER_SIZE + 2 * sizeof(uint32_t)) * -1, SEEK_END);
+    fread(&length, sizeof(uint32_t), 1, fp);
+    fread(&magic, sizeof(uint32_t), 1, fp);
+    uint32_t min_length = sizeof(uint64_t) + sizeof(uint32_t) * 3;  // number_bits and number_hashes
+    if (magic != EXTENSION_MAGIC || length < min_length || (long)length > filesize - TRAILER_SIZE) {
+        return 0;
+    }
+    uint32_t fields[EXT_FIELD_COUNT] = {0};  // missing fields use the default (0)
+    fields[EXT_NUMBER_HASHES] = cb->number_hashes;
+    uint32_t number_fields = (length - sizeof(uint64_t)) / sizeof(uint32_t) - 2;
+    if (number_fields > EXT_FIELD_COUNT) {
+        number_fields = EXT_FIELD_COUNT;
+    }
+    fseek(fp, (TRAILER_SIZE + length) * -1, SEEK_END);
+    fread(&cb->number_bits, sizeof(uint64_t), 1, fp);
+    fread(fields, sizeof(uint32_t), number_fields, fp);
+    __set_fields(cb, fields);
+    return length;
+}
+
+/* The layout options, as stored in the extension block and the shared memory header */
+static void __get_fields(const CountingBloom* cb, uint32_t* fields) {
+    fields[EXT_NUMBER_HASHES] = cb->number_hashes;
+    fields[EXT_HASH_MODE] = cb->hash_mode;
+    fields[EXT_INDEX_MODE] = cb->index_mode;
+    fields[EXT_HASH_TYPE] = cb->hash_type;
+    fields[EXT_COUNTER_WIDTH] = cb->counter_width;
+    fields[EXT_BLOCK_SIZE] = cb->block_size;
+}
+
+static void __set_fields(CountingBloom* cb, const uint32_t* fields) {
+    cb->number_hashes = fields[EXT_NUMBER_HASHES];
+    cb->hash_mode = (CountingBloomHashMode)fields[EXT_HASH_MODE];
+    cb->index_mode = (CountingBloomIndexMode)fields[EXT_INDEX_MODE];
+    cb->hash_type = (CountingBloomHashType)fields[EXT_HASH_TYPE];
+    cb->counter_width = (fields[EXT_COUNTER_WIDTH] == 0) ? 32 : fields[EXT_COUNTER_WIDTH];
+    cb->block_size = fields[EXT_BLOCK_SIZE];
+}
+
+/*
+    The parameters read from a file or shared memory header are only used after
+    this passes; it catches anything that would index outside of the counters
+    (or the stack arrays of hashes) rather than anything that is merely unusual.
+*/
+static int __check_layout(const CountingBloom* cb) {
+    if (cb->number_hashes == 0 || cb->number_hashes > COUNTING_BLOOM_MAX_HASHES || cb->number_bits == 0 || cb->number_bits > (UINT64_MAX >> 3)) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if (cb->counter_width != 4 && cb->counter_width != 8 && cb->counter_width != 16 && cb->counter_width != 32) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if ((unsigned int)cb->hash_mode > COUNTING_BLOOM_HASH_DOUBLE || (unsigned int)cb->index_mode > COUNTING_BLOOM_INDEX_POWER_OF_TWO ||
+        (unsigned int)cb->hash_type > COUNTING_BLOOM_HASH_TYPE_CRC32C) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if (cb->block_size != 0) {
+        if (cb->block_size < COUNTING_BLOOM_CACHE_LINE_SIZE || (cb->block_size & (cb->block_size - 1)) != 0 ||
+            cb->block_size > (UINT32_MAX >> 3) || cb->number_bits % ((cb->block_size * 8) / cb->counter_width) != 0) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+    }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/* Shared memory is always concurrent; opts may be NULL */
+static void __shared_options(CountingBloomOptions* opts, const CountingBloomOptions* passed) {
+    if (passed == NULL) {
+        counting_bloom_options_init(opts);
+    } else {
+        memcpy(opts, passed, sizeof(CountingBloomOptions));
+    }
+    opts->concurrent = 1;
+}
+
+static uint64_t __shared_offset(const CountingBloom* cb) {
+    uint64_t offset = (sizeof(SharedHeader) + COUNTING_BLOOM_CACHE_LINE_SIZE - 1) / COUNTING_BLOOM_CACHE_LINE_SIZE * COUNTING_BLOOM_CACHE_LINE_SIZE;
+    return (cb->block_size > offset) ? cb->block_size : offset;
+}
+
+/* Size fd for cb and map it with a new header; cb must have its parameters and options set */
+static int __create_shared(CountingBloom* cb, int fd, const char* name) {
+    // the new file is zero filled so the counters start cleared
+    uint64_t size = __shared_offset(cb) + __counter_bytes(cb);
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s!\n", name);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    SharedHeader* header = (SharedHeader*)mapping;
+    header->magic = SHARED_MAGIC;
+    header->sequence = 0;
+    header->estimated_elements = cb->estimated_elements;
+    header->number_bits = cb->number_bits;
+    header->elements_added = cb->elements_added;
+    header->false_positive_probability = cb->false_positive_probability;
+    __get_fields(cb, header->fields);
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+    __set_shared(cb, mapping, size);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/* Map fd and set up cb from its header */
+static int __open_shared(CountingBloom* cb, int fd, int prot, const char* name, const CountingBloomOptions* opts) {
+    struct stat buf;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &buf) == 0 && (uint64_t)buf.st_size >= sizeof(SharedHeader)) {
+        mapping = mmap(NULL, buf.st_size, prot, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s!\n", name);
+        return COUNTING_BLOOM_FAILURE;
+    }
+
+    const SharedHeader* header = (const SharedHeader*)mapping;
+    if (__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) != 1 || header->magic != SHARED_MAGIC) {
+        fprintf(stderr, "%s is not a counting bloom!\n", name);
+        munmap(mapping, buf.st_size);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    cb->estimated_elements = header->estimated_elements;
+    cb->false_positive_probability = header->false_positive_probability;
+    cb->number_bits = header->number_bits;
+    __set_fields(cb, header->fields);
+    // the header is checked like an imported file before anything is sized or indexed from it
+    if (cb->estimated_elements == 0 || !(cb->false_positive_probability > 0.0 && cb->false_positive_probability < 1.0) ||
+        __check_layout(cb) == COUNTING_BLOOM_FAILURE || (uint64_t)buf.st_size != __shared_offset(cb) + __counter_bytes(cb)) {
+        fprintf(stderr, "%s is not a counting bloom!\n", name);
+        munmap(mapping, buf.st_size);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    __update_block_layout(cb);
+    cb->__is_on_disk = 0;
+    cb->filepointer = NULL;
+    __set_hash_functions(cb, opts);
+    __set_runtime_options(cb, opts);
+    __set_shared(cb, mapping, buf.st_size);
+    cb->elements_added = __get_elements_added(cb);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+static void __set_shared(CountingBloom* cb, void* mapping, uint64_t size) {
+    cb->__mapping = mapping;
+    cb->__filesize = size;
+    cb->bloom = (uint32_t*)((char*)mapping + __shared_offset(cb));
+    cb->__shared_elements_added = &((SharedHeader*)mapping)->elements_added;
+}
+
+/* The counters of cb and other are laid out and hashed the same way */
+static int __same_parameters(const CountingBloom* cb, const CountingBloom* other) {
+    return cb->number_bits == other->number_bits && cb->number_hashes == other->number_hashes &&
+        cb->counter_width == other->counter_width && cb->block_size == other->block_size &&
+        cb->hash_mode == other->hash_mode && cb->index_mode == other->index_mode &&
+        cb->hash_type == other->hash_type && cb->hash_function == other->hash_function &&
+        cb->hash_function_into == other->hash_function_into && cb->hash_function_bytes == other->hash_function_bytes;
+}
+
+static __inline__ uint64_t __get_elements_added(const CountingBloom* cb) {
+    if (cb->__shared_elements_added != NULL) {
+        return __atomic_load_n(cb->__shared_elements_added, __ATOMIC_RELAXED);
+    }
+    return cb->elements_added;
 }
 
 static void __get_additional_stats(const CountingBloom* cb, uint64_t* largest, uint64_t* largest_index, uint64_t* els_added, float *fullness) {
     uint64_t i, sum = 0, lar = 0, cnt = 0, lar_idx = 0;
     for (i = 0; i < cb->number_bits; ++i) {
-        uint64_t tmp = cb->bloom[i];
+        uint64_t tmp = __get_counter(cb, i);
         sum += tmp;
         if (tmp > lar) {
             lar = tmp;
@@ -402,10 +2064,139 @@ static void __get_additional_stats(const CountingBloom* cb, uint64_t* largest, u
     *largest_index = lar_idx;
 }
 
+/*  In concurrent mode the count is updated atomically; the on disk trailer is then
+    only written when the filter is destroyed since it is not aligned for atomic stores */
+static __inline__ void __change_elements_added(CountingBloom* cb, int64_t change) {
+    if (cb->__shared_elements_added != NULL) {
+        // the cached copy is written by every thread changing the count so it is stored atomically too
+        __atomic_store_n(&cb->elements_added, __atomic_add_fetch(cb->__shared_elements_added, (uint64_t)change, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        return;
+    }
+    if (cb->concurrent == 1) {
+        __atomic_add_fetch(&cb->elements_added, (uint64_t)change, __ATOMIC_RELAXED);
+        return;
+    }
+    cb->elements_added += (uint64_t)change;
+    __update_elements_added_on_disk(cb);
+}
+
+static __inline__ uint32_t __atomic_get_counter(const CountingBloom* cb, uint64_t idx) {
+    switch (cb->counter_width) {
+        case 4:
+            return (__atomic_load_n(&((const uint8_t*)cb->bloom)[idx >> 1], __ATOMIC_RELAXED) >> ((idx & 1) << 2)) & 0x0F;
+        case 8:
+            return __atomic_load_n(&((const uint8_t*)cb->bloom)[idx], __ATOMIC_RELAXED);
+        case 16:
+            return __atomic_load_n(&((const uint16_t*)cb->bloom)[idx], __ATOMIC_RELAXED);
+        default:
+            return __atomic_load_n(&cb->bloom[idx], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+    Add delta (1 or -1) to a counter with compare and swap so that a saturated
+    counter stays saturated and a counter is never taken below zero, even when
+    another thread removed the same element between the check and the decrement.
+    4 bit counters swap the byte that holds them.
+*/
+/* Apply the change with compare and swap; see __apply_delta */
+static __inline__ void __atomic_update_counter(CountingBloom* cb, uint64_t idx, int64_t delta, int64_t peak) {
+    uint32_t max = __counter_max(cb);
+    switch (cb->counter_width) {
+        case 4: {
+            uint8_t* byte = &((uint8_t*)cb->bloom)[idx >> 1];
+            unsigned int shift = (idx & 1) << 2;
+            uint8_t old = __atomic_load_n(byte, __ATOMIC_RELAXED), value;
+            do {
+                uint32_t counter = (old >> shift) & 0x0F;
+                uint32_t updated = __apply_delta(counter, delta, peak, max);
+                if (updated == counter) {
+                    return;
+                }
+                value = (uint8_t)((old & ~(0x0F << shift)) | (updated << shift));
+            } while (!__atomic_compare_exchange_n(byte, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            break;
+        }
+        case 8: {
+            uint8_t* counter = &((uint8_t*)cb->bloom)[idx];
+            uint8_t old = __atomic_load_n(counter, __ATOMIC_RELAXED), value;
+            do {
+                value = (uint8_t)__apply_delta(old, delta, peak, max);
+                if (value == old) {
+                    return;
+                }
+            } while (!__atomic_compare_exchange_n(counter, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            break;
+        }
+        case 16: {
+            uint16_t* counter = &((uint16_t*)cb->bloom)[idx];
+            uint16_t old = __atomic_load_n(counter, __ATOMIC_RELAXED), value;
+            do {
+                value = (uint16_t)__apply_delta(old, delta, peak, max);
+                if (value == old) {
+                    return;
+                }
+            } while (!__atomic_compare_exchange_n(counter, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            break;
+        }
+        default: {
+            uint32_t* counter = &cb->bloom[idx];
+            uint32_t old = __atomic_load_n(counter, __ATOMIC_RELAXED), value;
+            do {
+                value = __apply_delta(old, delta, peak, max);
+                if (value == old) {
+                    return;
+                }
+            } while (!__atomic_compare_exchange_n(counter, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            break;
+        }
+    }
+}
+
+/*
+    The counter after a run of increments and decrements with the net change delta
+    and the largest running change peak. If the counter was saturated, or reached
+    the maximum at any point in the run, it stays saturated; otherwise it does not
+    go below zero. A single add is (1, 1) and a single remove is (-1, 0).
+*/
+static __inline__ uint32_t __apply_delta(uint32_t value, int64_t delta, int64_t peak, uint32_t max) {
+    if (value == max || (int64_t)value + peak >= (int64_t)max) {
+        return max;
+    }
+    int64_t res = (int64_t)value + delta;
+    return (res < 0) ? 0 : (uint32_t)res;
+}
+
+/* The slot for the counter, inserting an empty one if insert is set (NULL if not found) */
+static CountingBloomDelta* __find_delta(CountingBloomDeltas* deltas, uint64_t idx, short insert) {
+    uint64_t mask = deltas->capacity - 1;
+    for (uint64_t i = counting_bloom_mix_64(idx) & mask; ; i = (i + 1) & mask) {
+        CountingBloomDelta* slot = &deltas->slots[i];
+        if (slot->index == idx + 1) {
+            return slot;
+        }
+        if (slot->index == 0) {
+            if (insert == 0) {
+                return NULL;
+            }
+            slot->index = idx + 1;
+            ++deltas->used;
+            return slot;
+        }
+    }
+}
+
+/* Keep the map at most half full so probes stay short; an element needs up to number_hashes slots */
+static void __reserve_deltas(CountingBloomDeltas* deltas) {
+    if (deltas->used + deltas->cb->number_hashes > deltas->capacity / 2) {
+        counting_bloom_deltas_flush(deltas);
+    }
+}
+
+/* The trailer is part of the mapping; it is not aligned so it is copied in rather than stored */
 static void __update_elements_added_on_disk(CountingBloom* cb) {
     if (cb->__is_on_disk == 1) {
-        int offset = sizeof(uint64_t) + sizeof(float);
-        fseek(cb->filepointer, offset * -1, SEEK_END);
-        fwrite(&cb->elements_added, 1, sizeof(uint64_t), cb->filepointer);
+        char* elements_added = (char*)cb->bloom + cb->__filesize - (sizeof(uint64_t) + sizeof(float));
+        memcpy(elements_added, &cb->elements_added, sizeof(uint64_t));
     }
 }
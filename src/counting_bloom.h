@@ -26,7 +26,7 @@
 ***        counting_bloom_stats(&cb);
 ***        counting_bloom_destroy(&cb);
 ***
-***	Required Compile Flags: -lm
+***	Required Compile Flags: -lm (and -lrt for shared memory with glibc before 2.34)
 ***
 *******************************************************************************/
 
@@ -36,6 +36,7 @@ extern "C" {
 
 
 #include <inttypes.h>       /* PRIu64 */
+#include <stddef.h>         /* size_t */
 
 /* https://gcc.gnu.org/onlinedocs/gcc/Alternate-Keywords.html#Alternate-Keywords */
 #ifndef __GNUC__
@@ -54,10 +55,101 @@ extern "C" {
 
 #define COUNTING_BLOOM_SUCCESS 0
 #define COUNTING_BLOOM_FAILURE -1
+/* counting_bloom_check_and_add results; errors are COUNTING_BLOOM_FAILURE */
+#define COUNTING_BLOOM_ADDED 0
+#define COUNTING_BLOOM_PRESENT 1
 
 #define counting_bloom_get_version()	(COUNTING_BLOOMFILTER_VERSION)
 
+/* Upper bound on the number of hashes; used to size the stack buffers in the string functions */
+#define COUNTING_BLOOM_MAX_HASHES 256
+/* Upper bound on the capacity of a delta buffer (counting_bloom_deltas_init) */
+#define COUNTING_BLOOM_MAX_DELTAS 4294967296ULL
+
 typedef uint64_t* (*CountBloomHashFunction)       (int num_hashes, const char* key);
+/* Hash function that writes num_hashes values into the caller supplied results buffer */
+typedef void (*CountBloomHashFunctionInto)        (int num_hashes, const char* key, uint64_t* results);
+/* Hash function for length delimited (binary) keys; writes num_hashes values into results */
+typedef void (*CountBloomHashFunctionBytes)       (int num_hashes, const void* key, size_t len, uint64_t* results);
+
+/*
+    How the number_hashes hashes for an element are generated:
+        SEEDED: the hash function is asked for all of the hashes (default; pyprobables compatible)
+        DOUBLE: the hash function is asked for two base hashes and the rest are
+                derived as h1 + i * h2 (Kirsch-Mitzenmacher)
+*/
+typedef enum {
+    COUNTING_BLOOM_HASH_SEEDED = 0,
+    COUNTING_BLOOM_HASH_DOUBLE = 1
+} CountingBloomHashMode;
+
+/*
+    How a hash is reduced to an index into the counters:
+        MODULO:       hash % number_bits (default; pyprobables compatible)
+        FASTRANGE:    multiply-shift range reduction, (hash * number_bits) >> 64; uses the
+                      high bits of the hash so FNV-1a (and passed in) hashes are remixed
+                      first; WYHASH and CRC32C are used as is
+        POWER_OF_TWO: number_bits is rounded up to a power of two and the hash is masked
+*/
+typedef enum {
+    COUNTING_BLOOM_INDEX_MODULO = 0,
+    COUNTING_BLOOM_INDEX_FASTRANGE = 1,
+    COUNTING_BLOOM_INDEX_POWER_OF_TWO = 2
+} CountingBloomIndexMode;
+
+/*
+    Built-in hash used when no hash function is passed:
+        FNV_1A: seeded FNV-1a (default; pyprobables compatible)
+        WYHASH: wyhash; processes 8 to 48 bytes at a time
+        CRC32C: CRC32C based; uses the SSE4.2 crc32 instruction when the CPU supports it
+    WYHASH and CRC32C hash the key once and derive the rest of the hashes using
+    double hashing.
+*/
+typedef enum {
+    COUNTING_BLOOM_HASH_TYPE_FNV_1A = 0,
+    COUNTING_BLOOM_HASH_TYPE_WYHASH = 1,
+    COUNTING_BLOOM_HASH_TYPE_CRC32C = 2
+} CountingBloomHashType;
+
+/*
+    How the counters are laid out:
+        STANDARD: each hash selects any counter (default; pyprobables compatible)
+        BLOCKED:  the first hash selects a 64 byte (cache line) block and all of the
+                  counters for an element are within that block; a lookup then costs
+                  about one cache miss. The number of bits is increased so that the
+                  false positive rate still holds.
+        PAGE_BLOCKED: the same with a page (or larger I/O block) sized block so
+                  that each operation on an on disk filter costs at most one page
+                  fault or disk read; the block size is set in the options
+*/
+typedef enum {
+    COUNTING_BLOOM_LAYOUT_STANDARD = 0,
+    COUNTING_BLOOM_LAYOUT_BLOCKED = 1,
+    COUNTING_BLOOM_LAYOUT_PAGE_BLOCKED = 2
+} CountingBloomLayout;
+
+/*
+    How check and get max insertions read 32 bit counters:
+        SCALAR: one counter at a time (default)
+        AUTO:   AVX-512 or AVX2 gathers, whichever the CPU supports
+        AVX2 / AVX512: that instruction set only
+    The CPU is checked at initialization and the scalar loop is used if it does not
+    support the instruction set. The results are the same; gathers tend to only be
+    faster for small filters that stay in cache and on CPUs where gathers are not
+    slowed by microcode mitigations, so measure before enabling.
+*/
+typedef enum {
+    COUNTING_BLOOM_PROBE_SCALAR = 0,
+    COUNTING_BLOOM_PROBE_AUTO = 1,
+    COUNTING_BLOOM_PROBE_AVX2 = 2,
+    COUNTING_BLOOM_PROBE_AVX512 = 3
+} CountingBloomProbe;
+
+/* Smallest of the counters at the indices; stops at the first zero */
+typedef uint32_t (*CountBloomProbeFunction)(const uint32_t* counters, const uint64_t* indices, unsigned int number_hashes);
+
+#define COUNTING_BLOOM_CACHE_LINE_SIZE 64
+#define COUNTING_BLOOM_PAGE_SIZE 4096
 
 typedef struct counting_bloom_filter {
     /* bloom parameters */
@@ -65,16 +157,100 @@ typedef struct counting_bloom_filter {
     float false_positive_probability;
     unsigned int number_hashes;
     uint64_t number_bits;
-    /* bloom filter */
+    CountingBloomHashMode hash_mode;
+    CountingBloomIndexMode index_mode;
+    CountingBloomHashType hash_type;
+    unsigned int counter_width;
+    unsigned int block_size;  /* bytes per block; 0 if not blocked */
+    /* bloom filter; the counters are only uint32_t when counter_width is 32 */
     uint32_t* bloom;
     uint64_t elements_added;
     CountBloomHashFunction hash_function;
+    CountBloomHashFunctionInto hash_function_into;
+    CountBloomHashFunctionBytes hash_function_bytes;
     /* on disk handeling */
     short __is_on_disk;
     FILE* filepointer;
     uint64_t __filesize;
+    /* blocked layout */
+    uint64_t __number_blocks;
+    unsigned int __block_counters;
+    unsigned int __block_shift;
+    /* probe for 32 bit counters */
+    CountBloomProbeFunction __probe_32;
+    /* set if the counting bloom can be shared between threads */
+    short concurrent;
+    /* shared memory: the mapping (header and counters) and the elements added in its header */
+    void* __mapping;
+    uint64_t* __shared_elements_added;
 } CountingBloom;
 
+/*
+    Options used when initializing or importing a counting bloom. Set with
+    counting_bloom_options_init() and then override only what is needed.
+
+    Only one hash function needs to be set; they are preferred in the order
+    hash_function_bytes, hash_function_into, hash_function. If all are NULL the
+    default hash is used. The string hash functions are passed a NUL terminated
+    copy of keys added using the *_bytes functions.
+
+    Layout options (e.g., hash_mode) are stored in the exported file; they are
+    only used on initialization and are read back from the file on import.
+
+    Counters saturate at the largest value for the counter_width and then stay
+    there (they are no longer incremented or decremented).
+
+    In concurrent mode the add, check, remove, and get max insertions functions
+    (including the batches) may be called from several threads without a lock;
+    counters are changed with atomic compare and swap and checks are plain atomic
+    reads. Each counter update is atomic but an element is not: a check may see an
+    element that is part way through being added, and check_and_add may add an
+    element twice if two threads add it at the same time. elements_added is updated
+    atomically and, for on disk filters, written to the file on destroy. Clear,
+    export, and destroy still require that no other thread is using the filter.
+*/
+typedef struct counting_bloom_options {
+    CountBloomHashFunction hash_function;
+    CountBloomHashFunctionInto hash_function_into;
+    CountBloomHashFunctionBytes hash_function_bytes;
+    CountingBloomHashMode hash_mode;
+    CountingBloomIndexMode index_mode;
+    CountingBloomHashType hash_type;
+    unsigned int counter_width;  /* bits per counter: 4, 8, 16, or 32 (default; 0 is the same as 32) */
+    CountingBloomLayout layout;
+    unsigned int block_size;  /* bytes per block for PAGE_BLOCKED: a power of 2 of at least 64 (0 is the page size) */
+    CountingBloomProbe probe;
+    short concurrent;  /* allow add, check, and remove from several threads at once (see below) */
+    short preallocate;  /* on disk: reserve the file's blocks up front instead of leaving it sparse */
+} CountingBloomOptions;
+
+/* A pending change to one counter; see CountingBloomDeltas */
+typedef struct {
+    uint64_t index;  /* counter index + 1; 0 is an empty slot */
+    int64_t delta;   /* net change */
+    int64_t peak;    /* largest running change; a counter that would have saturated stays saturated */
+} CountingBloomDelta;
+
+/*
+    A private write buffer in front of a shared counting bloom. Adds and removes
+    through the buffer combine per counter in a small open addressed map and are
+    written to the counting bloom together on flush, so a thread that adds the
+    same (hot) keys over and over only touches their counters once per flush.
+    The result is the same as making the adds and removes at the time of the
+    flush, including saturation. Use one buffer per thread; the counting bloom must
+    be concurrent if several threads flush into it.
+*/
+typedef struct counting_bloom_deltas {
+    CountingBloom* cb;
+    CountingBloomDelta* slots;
+    uint64_t capacity;
+    uint64_t used;
+    int64_t elements_added;  /* pending change to cb->elements_added */
+} CountingBloomDeltas;
+
+/* Set the options to the defaults (i.e., the same as counting_bloom_init) */
+void counting_bloom_options_init(CountingBloomOptions* opts);
+
 /*
     Initialize a standard counting bloom filter in memory; this will provide 'optimal' size
     and hash numbers.
@@ -82,17 +258,91 @@ typedef struct counting_bloom_filter {
     Estimated elements is 0 < x <= UINT64_MAX.
     False positive rate is 0.0 < x < 1.0
 */
+int counting_bloom_init_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts);
 int counting_bloom_init_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, CountBloomHashFunction hash_function);
 static __inline__ int counting_bloom_init(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate) {
     return counting_bloom_init_alt(cb, estimated_elements, false_positive_rate, NULL);
 }
 
-/* Initialize a counting bloom directly into file; useful if the counting bloom is larger than available RAM */
+/*
+    Initialize a counting bloom directly into file; useful if the counting bloom is larger than available RAM
+    NOTE: The counters are not written; the file is created sparse (blocks are allocated as counters are
+          first changed) unless opts->preallocate is set
+*/
+int counting_bloom_init_on_disk_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath, const CountingBloomOptions* opts);
 int counting_bloom_init_on_disk_alt(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath, CountBloomHashFunction hash_function);
 static __inline__ int counting_bloom_init_on_disk(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* filepath) {
     return counting_bloom_init_on_disk_alt(cb, estimated_elements, false_positive_rate, filepath, NULL);
 }
 
+/*
+    Create a counting bloom in the POSIX shared memory object name (e.g., "/my-bloom";
+    see shm_open) that other processes can attach to. opts may be NULL. The
+    parameters and elements added are kept in a header in front of the counters;
+    the counting bloom is always concurrent so any process (or thread) may add,
+    check, and remove at the same time. cb->elements_added is this process' view
+    of the count, refreshed (atomically) whenever it changes the count, so with
+    several threads it may briefly lag; stats, export, and the current false
+    positive rate read the shared value.
+    NOTE: Fails if name already exists; destroy unmaps but does not remove it
+*/
+int counting_bloom_init_shared_opts(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* name, const CountingBloomOptions* opts);
+static __inline__ int counting_bloom_init_shared(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const char* name) {
+    return counting_bloom_init_shared_opts(cb, estimated_elements, false_positive_rate, name, NULL);
+}
+
+/* Attach to a counting bloom created by counting_bloom_init_shared; the hash functions (opts) must match the creator's */
+int counting_bloom_attach_shared_opts(CountingBloom* cb, const char* name, const CountingBloomOptions* opts);
+static __inline__ int counting_bloom_attach_shared(CountingBloom* cb, const char* name) {
+    return counting_bloom_attach_shared_opts(cb, name, NULL);
+}
+
+/* Remove the shared memory name; processes already attached keep their mapping */
+int counting_bloom_unlink_shared(const char* name);
+
+/*
+    Read replicas: a writer process keeps changing a master counting bloom and
+    periodically publishes it into a replica file that reader processes map read
+    only. Publishing takes a sequence lock in the file's header, so readers never
+    block the writer; a reader checks keys between read_begin and read_retry and
+    repeats the checks if a publish overlapped them:
+
+        uint64_t seq;
+        do {
+            seq = counting_bloom_replica_read_begin(&replica);
+            res = counting_bloom_check_string(&replica, "google");
+        } while (counting_bloom_replica_read_retry(&replica, seq));
+*/
+
+/*
+    Create the replica file filepath with the parameters and hash functions of cb and
+    publish cb. The file is built under a temporary name and renamed over filepath,
+    so readers that opened an earlier replica keep reading it until they reopen.
+*/
+int counting_bloom_init_replica(CountingBloom* replica, const CountingBloom* cb, const char* filepath);
+
+/* Copy the counters and elements added of cb into the replica; only the writer may call this */
+int counting_bloom_replica_publish(CountingBloom* replica, const CountingBloom* cb);
+
+/*
+    Map a replica file read only; the hash functions (opts) must match the writer's.
+    The counting bloom may only be passed to functions that take a const CountingBloom*
+*/
+int counting_bloom_open_replica_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts);
+static __inline__ int counting_bloom_open_replica(CountingBloom* cb, const char* filepath) {
+    return counting_bloom_open_replica_opts(cb, filepath, NULL);
+}
+
+/*
+    Start a consistent read of a replica; waits out a publish in progress.
+    NOTE: A counting bloom that is not mapped (not a replica or shared) is never
+          published into; read_begin returns 0 and read_retry never asks for a retry
+*/
+uint64_t counting_bloom_replica_read_begin(const CountingBloom* cb);
+
+/* Returns non-zero if the replica was published since read_begin returned sequence and the reads must be repeated */
+int counting_bloom_replica_read_retry(const CountingBloom* cb, uint64_t sequence);
+
 /* Print out statistics about the counting bloom filter */
 void counting_bloom_stats(const CountingBloom* cb);
 
@@ -105,31 +355,154 @@ int counting_bloom_clear(CountingBloom* cb);
 /*  Add a string (or element) to the counting bloom filter */
 int counting_bloom_add_string(CountingBloom* cb, const char* key);
 
+/* Add a key of len bytes (e.g., binary data) to the counting bloom filter */
+int counting_bloom_add_bytes(CountingBloom* cb, const void* key, size_t len);
+
+/*
+    Add a 64 bit integer key (e.g., an already hashed id) to the counting bloom filter.
+    Integer keys are mixed directly into indices without the hash function, so
+    the integer 5 and the string "5" are different keys.
+*/
+int counting_bloom_add_u64(CountingBloom* cb, uint64_t key);
+
+/*
+    Add n keys to the counting bloom filter. If lens is NULL the keys are strings
+    (same as counting_bloom_add_string), otherwise keys[i] is lens[i] bytes (same as
+    counting_bloom_add_bytes). Keys are hashed ahead of the counter updates so that
+    the memory loads for several keys overlap; elements added (and the on disk
+    header) are updated once for the batch.
+    NOTE: If hashing a key fails, the keys before it are still added
+*/
+int counting_bloom_add_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n);
+
+/*
+    Increment the counters at the passed indices (see counting_bloom_calculate_indices),
+    saturating as the add functions do, and add number_elements to elements added.
+    The indices of several elements may be applied in any order and in parts (e.g.,
+    split by counter range with number_elements of 0 for all but one part) and
+    give the same counters as adding the elements one at a time. Threads may
+    apply indices at the same time if each owns a range of counters that starts
+    and ends on a multiple of 64 counters.
+*/
+int counting_bloom_add_indices(CountingBloom* cb, const uint64_t* indices, uint64_t number_indices, uint64_t number_elements);
+
 /* Add a string to a counting bloom filter using the passed hashes */
 int counting_bloom_add_string_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed);
 
+/*
+    Check if a string (or element) is in the counting bloom and add it if it is not;
+    the key is hashed once and each counter is only loaded once. Returns
+    COUNTING_BLOOM_PRESENT if the key was already present (and is not added again),
+    COUNTING_BLOOM_ADDED if it was added, and COUNTING_BLOOM_FAILURE if it could
+    not be hashed (nothing is added).
+    NOTE: In concurrent mode the check and the add are separate steps; two threads
+          adding the same new key at the same time may both get COUNTING_BLOOM_ADDED
+          and add it twice
+*/
+int counting_bloom_check_and_add(CountingBloom* cb, const char* key);
+
+/* Same as counting_bloom_check_and_add for a key of len bytes */
+int counting_bloom_check_and_add_bytes(CountingBloom* cb, const void* key, size_t len);
+
+/* Same as counting_bloom_check_and_add using the passed hashes */
+int counting_bloom_check_and_add_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed);
+
+/*
+    Check and add n keys (see counting_bloom_add_batch for keys and lens). Bit i of
+    the results bitmap is set if key i was already present, including from earlier
+    in the same batch; results must hold at least (n + 7) / 8 bytes.
+*/
+int counting_bloom_check_and_add_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results);
+
 /* Check to see if a string (or element) is or is not in the counting bloom */
 int counting_bloom_check_string(const CountingBloom* cb, const char* key);
 
+/* Check to see if a key of len bytes is or is not in the counting bloom */
+int counting_bloom_check_bytes(const CountingBloom* cb, const void* key, size_t len);
+
+/* Check to see if a 64 bit integer key is or is not in the counting bloom */
+int counting_bloom_check_u64(const CountingBloom* cb, uint64_t key);
+
+/*
+    Check n keys (see counting_bloom_add_batch for keys and lens). Bit i of the
+    results bitmap, results[i / 8] & (1 << (i % 8)), is set if key i may be in the
+    counting bloom; results must hold at least (n + 7) / 8 bytes.
+*/
+int counting_bloom_check_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results);
+
 /* Check if a string is in the counting bloom using the passed hashes */
 int counting_bloom_check_string_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed);
 
 /* Determine the maximum number of times a string could have been inserted */
 int counting_bloom_get_max_insertions(const CountingBloom* cb, const char* key);
 
+/* Determine the maximum number of times a key of len bytes could have been inserted */
+int counting_bloom_get_max_insertions_bytes(const CountingBloom* cb, const void* key, size_t len);
+
+/* Determine the maximum number of times a 64 bit integer key could have been inserted */
+int counting_bloom_get_max_insertions_u64(const CountingBloom* cb, uint64_t key);
+
+/*
+    Determine the maximum number of times each of n keys could have been inserted
+    (see counting_bloom_add_batch for keys and lens); results must hold n counts
+*/
+int counting_bloom_get_max_insertions_batch(const CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint32_t* results);
+
 /* Determine the maximum number of times an element could have been inserted based on the passed hashes */
 int counting_bloom_get_max_insertions_alt(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed);
 
 /* Remove a string from the counting bloom */
 int counting_bloom_remove_string(CountingBloom* cb, const char* key);
 
+/* Remove a key of len bytes from the counting bloom */
+int counting_bloom_remove_bytes(CountingBloom* cb, const void* key, size_t len);
+
+/* Remove a 64 bit integer key from the counting bloom */
+int counting_bloom_remove_u64(CountingBloom* cb, uint64_t key);
+
+/*
+    Remove n keys (see counting_bloom_add_batch for keys and lens). As with
+    counting_bloom_remove_string a key is only removed if it is present; bit i of
+    the results bitmap is set if key i was removed. results must hold at least
+    (n + 7) / 8 bytes. Elements added (and the on disk header) are updated once.
+*/
+int counting_bloom_remove_batch(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, uint8_t* results);
+
 /* Remove an element from the counting bloom based on the passed hashes */
 int counting_bloom_remove_string_alt(CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed);
 
+/*
+    Initialize a delta buffer for cb that holds up to capacity counters (rounded up
+    to a power of 2) before it flushes itself. Fails if capacity is more than
+    COUNTING_BLOOM_MAX_DELTAS.
+*/
+int counting_bloom_deltas_init(CountingBloomDeltas* deltas, CountingBloom* cb, uint64_t capacity);
+
+/* Flush the pending changes and release the delta buffer; cb is not destroyed */
+int counting_bloom_deltas_destroy(CountingBloomDeltas* deltas);
+
+/* Write the pending changes (and elements added) to the counting bloom */
+int counting_bloom_deltas_flush(CountingBloomDeltas* deltas);
+
+/* Add a string, a key of len bytes, or an element with the passed hashes through the delta buffer */
+int counting_bloom_deltas_add_string(CountingBloomDeltas* deltas, const char* key);
+int counting_bloom_deltas_add_bytes(CountingBloomDeltas* deltas, const void* key, size_t len);
+int counting_bloom_deltas_add_alt(CountingBloomDeltas* deltas, const uint64_t* hashes, unsigned int number_hashes_passed);
+
+/*
+    Remove through the delta buffer. As with counting_bloom_remove_string the element
+    is only removed if it is present, counting both the counting bloom and the
+    pending changes.
+*/
+int counting_bloom_deltas_remove_string(CountingBloomDeltas* deltas, const char* key);
+int counting_bloom_deltas_remove_bytes(CountingBloomDeltas* deltas, const void* key, size_t len);
+int counting_bloom_deltas_remove_alt(CountingBloomDeltas* deltas, const uint64_t* hashes, unsigned int number_hashes_passed);
+
 /* Export the current counting bloom to file */
 int counting_bloom_export(const CountingBloom* cb, const char* filepath);
 
 /* Import a previously exported counting bloom from a file into memory */
+int counting_bloom_import_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts);
 int counting_bloom_import_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function);
 static __inline__ int counting_bloom_import(CountingBloom* cb, const char* filepath) {
     return counting_bloom_import_alt(cb, filepath, NULL);
@@ -140,6 +513,7 @@ static __inline__ int counting_bloom_import(CountingBloom* cb, const char* filep
     This is allows for the speed / storage trade off of not needing to put the full counting bloom
     into RAM.
 */
+int counting_bloom_import_on_disk_opts(CountingBloom* cb, const char* filepath, const CountingBloomOptions* opts);
 int counting_bloom_import_on_disk_alt(CountingBloom* cb, const char* filepath, CountBloomHashFunction hash_function);
 static __inline__ int counting_bloom_import_on_disk(CountingBloom* cb, const char* filepath) {
     return counting_bloom_import_on_disk_alt(cb, filepath, NULL);
@@ -157,9 +531,44 @@ float counting_bloom_current_false_positive_rate(const CountingBloom* cb);
 */
 uint64_t* counting_bloom_calculate_hashes(const CountingBloom* cb, const char* key, unsigned int number_hashes);
 
+/*
+    Same as counting_bloom_calculate_hashes except the hashes are written into the
+    passed results buffer which must hold at least number_hashes elements.
+*/
+int counting_bloom_calculate_hashes_into(const CountingBloom* cb, const char* key, unsigned int number_hashes, uint64_t* results);
+
+/* Generate the hashes for a key of len bytes into the passed results buffer */
+int counting_bloom_calculate_hashes_bytes_into(const CountingBloom* cb, const void* key, size_t len, unsigned int number_hashes, uint64_t* results);
+
+/* Generate the hashes for a 64 bit integer key into the passed results buffer; does not use the hash function */
+void counting_bloom_calculate_hashes_u64_into(uint64_t key, unsigned int number_hashes, uint64_t* results);
+
+/*  SplitMix64 finalizer (http://xorshift.di.unimi.it/splitmix64.c); remixes a hash
+    so that all of its bits depend on all of the input bits. Shared by the modules
+    that derive more than one choice (e.g., shard and block) from the same hash */
+static __inline__ uint64_t counting_bloom_mix_64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Reduce the hashes of an element to its number_hashes counter indices; indices must hold number_hashes elements */
+int counting_bloom_calculate_indices(const CountingBloom* cb, const uint64_t* hashes, unsigned int number_hashes_passed, uint64_t* indices);
+
+/*
+    Add the counters of other into cb, saturating at the largest value for the counter
+    width, and add its elements added. Both must have been initialized with the same
+    parameters, options, and hash function; otherwise COUNTING_BLOOM_FAILURE is returned.
+    cb must not be modified by another thread during the merge.
+*/
+int counting_bloom_merge(CountingBloom* cb, const CountingBloom* other);
+
 /* Count the number of bits set to 1 (i.e., greater than 0) */
 uint64_t counting_bloom_count_set_bits(const CountingBloom* cb);
 
+/* Number of bytes that hold the counters (cb->bloom) for the counter width */
+uint64_t counting_bloom_counter_bytes(const CountingBloom* cb);
+
 /* Calculate the size the bloom filter will take on disk when exported in bytes */
 uint64_t counting_bloom_export_size(const CountingBloom* cb);
 
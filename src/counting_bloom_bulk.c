@@ -0,0 +1,506 @@
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***
+***	 License: MIT 2015
+***
+*******************************************************************************/
+#include <stdlib.h>         /* calloc, malloc, realloc */
+#include <stdio.h>          /* fopen, fread, fseeko */
+#include <string.h>         /* memchr, memmove, memcpy */
+#include <pthread.h>        /* pthread_create, pthread_join, pthread_barrier_wait */
+#include <sys/types.h>      /* off_t */
+#include <sys/stat.h>       /* stat */
+
+#include "counting_bloom_bulk.h"
+
+static const size_t BULK_BUFFER_SIZE = 1 << 20;     // bytes read from a file at a time
+static const uint64_t BULK_MIN_RANGE = 1 << 16;     // files are not split into ranges smaller than this
+static const uint64_t BULK_BATCH_SIZE = 256;        // keys passed to counting_bloom_add_batch at a time
+static const uint64_t PIPELINE_ROUND_SIZE = 1 << 16; // keys hashed per pipeline round
+static const uint64_t PIPELINE_ALIGNMENT = 64;      // counters; keeps 4 bit counter ranges from sharing a byte
+
+typedef struct {
+    const char* filepath;
+    uint64_t start;
+    uint64_t end;
+} BulkRange;
+
+typedef struct {
+    BulkRange* ranges;
+    uint64_t number_ranges;
+    uint64_t next_range;
+} BulkWork;
+
+typedef struct {
+    BulkWork* work;
+    CountingBloom* cb;
+    CountingBloom* other;
+    int res;
+} BulkThread;
+
+typedef struct {
+    uint64_t* indices;
+    uint64_t size;
+    uint64_t capacity;
+} PipelineQueue;
+
+typedef enum {
+    PIPELINE_WAIT = 0,
+    PIPELINE_RUN = 1,
+    PIPELINE_ABORT = 2
+} PipelineState;
+
+/*
+    queues[buffer][hash thread][apply thread]; a hash thread only writes its own
+    queues and an apply thread only reads the queues for its counter range
+*/
+typedef struct {
+    CountingBloom* cb;
+    const char* const* keys;
+    const size_t* lens;
+    uint64_t n;
+    unsigned int hash_threads;
+    unsigned int apply_threads;
+    uint64_t range_counters;
+    PipelineQueue* queues;
+    pthread_barrier_t barrier;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    PipelineState state;
+    uint64_t added;
+    int res;
+} Pipeline;
+
+typedef struct {
+    Pipeline* pipeline;
+    unsigned int id;
+} PipelineThread;
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+static BulkRange* __split_files(const char* const* filepaths, unsigned int number_files, unsigned int number_threads, uint64_t* number_ranges);
+static void* __build_worker(void* arg);
+static void* __merge_worker(void* arg);
+static int __build_range(CountingBloom* cb, const BulkRange* range);
+static int __add_keys(CountingBloom* cb, const char** keys, uint64_t* number_keys);
+static void* __pipeline_worker(void* arg);
+static int __pipeline_hash(Pipeline* pipeline, unsigned int h, uint64_t round);
+static void __pipeline_apply(Pipeline* pipeline, unsigned int a, uint64_t round);
+static __inline__ PipelineQueue* __pipeline_queue(Pipeline* pipeline, uint64_t round, unsigned int h, unsigned int a);
+static int __queue_push(PipelineQueue* queue, uint64_t idx);
+
+
+/*******************************************************************************
+***		PUBLIC FUNCTION DECLARATIONS
+*******************************************************************************/
+int counting_bloom_bulk_build(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts, const char* const* filepaths, unsigned int number_files, unsigned int number_threads) {
+    if (number_files == 0 || number_threads == 0) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    BulkWork work;
+    work.next_range = 0;
+    work.ranges = __split_files(filepaths, number_files, number_threads, &work.number_ranges);
+    if (work.ranges == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    if (work.number_ranges < number_threads) {
+        number_threads = (unsigned int)work.number_ranges;
+    }
+
+    CountingBloomOptions options;
+    if (opts == NULL) {
+        counting_bloom_options_init(&options);
+    } else {
+        memcpy(&options, opts, sizeof(CountingBloomOptions));
+    }
+    if (counting_bloom_init_opts(cb, estimated_elements, false_positive_rate, &options) == COUNTING_BLOOM_FAILURE) {
+        free(work.ranges);
+        return COUNTING_BLOOM_FAILURE;
+    }
+
+    // the first thread adds directly into cb; the private blooms never need atomics
+    options.concurrent = 0;
+    CountingBloom* blooms = (CountingBloom*)calloc(number_threads, sizeof(CountingBloom));
+    BulkThread* threads = (BulkThread*)calloc(number_threads, sizeof(BulkThread));
+    pthread_t* ids = (pthread_t*)calloc(number_threads, sizeof(pthread_t));
+    int res = (blooms == NULL || threads == NULL || ids == NULL) ? COUNTING_BLOOM_FAILURE : COUNTING_BLOOM_SUCCESS;
+    unsigned int initialized = 0;
+    for (unsigned int t = 1; t < number_threads && res == COUNTING_BLOOM_SUCCESS; ++t) {
+        res = counting_bloom_init_opts(&blooms[t], estimated_elements, false_positive_rate, &options);
+        initialized += (res == COUNTING_BLOOM_SUCCESS) ? 1 : 0;
+    }
+    if (res == COUNTING_BLOOM_SUCCESS) {
+        // the ranges are taken from a shared counter so the started threads still finish them all
+        unsigned int started = 0;
+        for (unsigned int t = 0; t < number_threads; ++t, ++started) {
+            threads[t].work = &work;
+            threads[t].cb = (t == 0) ? cb : &blooms[t];
+            if (pthread_create(&ids[t], NULL, __build_worker, &threads[t]) != 0) {
+                res = COUNTING_BLOOM_FAILURE;
+                break;
+            }
+        }
+        for (unsigned int t = 0; t < started; ++t) {
+            pthread_join(ids[t], NULL);
+            res = (threads[t].res == COUNTING_BLOOM_FAILURE) ? COUNTING_BLOOM_FAILURE : res;
+        }
+    }
+
+    // merge in parallel pairs, bloom t takes bloom t + step, until everything is in cb
+    for (unsigned int step = 1; step < number_threads && res == COUNTING_BLOOM_SUCCESS; step *= 2) {
+        unsigned int end = 0;  // past the last pair that started
+        for (unsigned int t = 0; t + step < number_threads; t += 2 * step, end = t) {
+            threads[t].other = threads[t + step].cb;
+            if (pthread_create(&ids[t], NULL, __merge_worker, &threads[t]) != 0) {
+                res = COUNTING_BLOOM_FAILURE;
+                break;
+            }
+        }
+        for (unsigned int t = 0; t < end; t += 2 * step) {
+            pthread_join(ids[t], NULL);
+            res = (threads[t].res == COUNTING_BLOOM_FAILURE) ? COUNTING_BLOOM_FAILURE : res;
+        }
+    }
+
+    for (unsigned int t = 1; t <= initialized; ++t) {
+        counting_bloom_destroy(&blooms[t]);
+    }
+    free(blooms);
+    free(threads);
+    free(ids);
+    free(work.ranges);
+    if (res == COUNTING_BLOOM_FAILURE) {
+        counting_bloom_destroy(cb);
+    }
+    return res;
+}
+
+int counting_bloom_pipeline_add(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, unsigned int hash_threads, unsigned int apply_threads) {
+    if (hash_threads == 0 || apply_threads == 0) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    Pipeline pipeline;
+    pipeline.cb = cb;
+    pipeline.keys = keys;
+    pipeline.lens = lens;
+    pipeline.n = n;
+    pipeline.hash_threads = hash_threads;
+    pipeline.apply_threads = apply_threads;
+    pipeline.added = 0;
+    pipeline.res = COUNTING_BLOOM_SUCCESS;
+    // equal counter ranges rounded up to the alignment
+    uint64_t range = (cb->number_bits + apply_threads - 1) / apply_threads;
+    pipeline.range_counters = (range + PIPELINE_ALIGNMENT - 1) / PIPELINE_ALIGNMENT * PIPELINE_ALIGNMENT;
+
+    unsigned int number_threads = hash_threads + apply_threads;
+    pipeline.queues = (PipelineQueue*)calloc(2 * (uint64_t)hash_threads * apply_threads, sizeof(PipelineQueue));
+    PipelineThread* threads = (PipelineThread*)calloc(number_threads, sizeof(PipelineThread));
+    pthread_t* ids = (pthread_t*)calloc(number_threads, sizeof(pthread_t));
+    if (pipeline.queues == NULL || threads == NULL || ids == NULL) {
+        free(pipeline.queues);
+        free(threads);
+        free(ids);
+        return COUNTING_BLOOM_FAILURE;
+    }
+
+    /*  The barrier needs every thread, so the workers wait at the start until all of
+        them were created; if one could not be, the others stop without touching it */
+    pthread_barrier_init(&pipeline.barrier, NULL, number_threads);
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.start, NULL);
+    pipeline.state = PIPELINE_WAIT;
+    unsigned int started = 0;
+    for (unsigned int t = 0; t < number_threads; ++t, ++started) {
+        threads[t].pipeline = &pipeline;
+        threads[t].id = t;
+        if (pthread_create(&ids[t], NULL, __pipeline_worker, &threads[t]) != 0) {
+            pipeline.res = COUNTING_BLOOM_FAILURE;
+            break;
+        }
+    }
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.state = (started == number_threads) ? PIPELINE_RUN : PIPELINE_ABORT;
+    pthread_cond_broadcast(&pipeline.start);
+    pthread_mutex_unlock(&pipeline.lock);
+    for (unsigned int t = 0; t < started; ++t) {
+        pthread_join(ids[t], NULL);
+    }
+    pthread_cond_destroy(&pipeline.start);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_barrier_destroy(&pipeline.barrier);
+
+    counting_bloom_add_indices(cb, NULL, 0, pipeline.added);
+    for (uint64_t q = 0; q < 2 * (uint64_t)hash_threads * apply_threads; ++q) {
+        free(pipeline.queues[q].indices);
+    }
+    free(pipeline.queues);
+    free(threads);
+    free(ids);
+    return pipeline.res;
+}
+
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+/* Split each file into about number_threads ranges so a single large file still uses every thread */
+static BulkRange* __split_files(const char* const* filepaths, unsigned int number_files, unsigned int number_threads, uint64_t* number_ranges) {
+    BulkRange* ranges = (BulkRange*)calloc((uint64_t)number_files * number_threads, sizeof(BulkRange));
+    if (ranges == NULL) {
+        return NULL;
+    }
+    uint64_t n = 0;
+    for (unsigned int i = 0; i < number_files; ++i) {
+        struct stat st;
+        if (stat(filepaths[i], &st) != 0) {
+            fprintf(stderr, "Can't open file %s!\n", filepaths[i]);
+            free(ranges);
+            return NULL;
+        }
+        uint64_t size = (uint64_t)st.st_size;
+        uint64_t parts = size / BULK_MIN_RANGE;
+        parts = (parts == 0) ? 1 : (parts > number_threads) ? number_threads : parts;
+        for (uint64_t p = 0; p < parts; ++p) {
+            ranges[n].filepath = filepaths[i];
+            ranges[n].start = size * p / parts;
+            ranges[n].end = size * (p + 1) / parts;
+            ++n;
+        }
+    }
+    *number_ranges = n;
+    return ranges;
+}
+
+static void* __build_worker(void* arg) {
+    BulkThread* thread = (BulkThread*)arg;
+    BulkWork* work = thread->work;
+    thread->res = COUNTING_BLOOM_SUCCESS;
+    uint64_t i;
+    while ((i = __atomic_fetch_add(&work->next_range, 1, __ATOMIC_RELAXED)) < work->number_ranges) {
+        if (__build_range(thread->cb, &work->ranges[i]) == COUNTING_BLOOM_FAILURE) {
+            thread->res = COUNTING_BLOOM_FAILURE;
+        }
+    }
+    return NULL;
+}
+
+static void* __merge_worker(void* arg) {
+    BulkThread* thread = (BulkThread*)arg;
+    thread->res = counting_bloom_merge(thread->cb, thread->other);
+    return NULL;
+}
+
+/*
+    Add the lines that start in [start, end). A range that does not start the file
+    skips the line that runs into it (it belongs to the previous range) by starting
+    one byte early and dropping everything through the first newline.
+*/
+static int __build_range(CountingBloom* cb, const BulkRange* range) {
+    FILE* fp = fopen(range->filepath, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", range->filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    short skip = (range->start > 0) ? 1 : 0;
+    uint64_t offset = range->start - skip;  // file offset of buffer[0]
+    if (fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return COUNTING_BLOOM_FAILURE;
+    }
+
+    size_t capacity = BULK_BUFFER_SIZE, used = 0;
+    char* buffer = (char*)malloc(capacity + 1);
+    const char** keys = (const char**)malloc(BULK_BATCH_SIZE * sizeof(const char*));
+    uint64_t number_keys = 0;
+    int res = (buffer == NULL || keys == NULL) ? COUNTING_BLOOM_FAILURE : COUNTING_BLOOM_SUCCESS;
+    short done = 0;
+    while (res == COUNTING_BLOOM_SUCCESS && done == 0) {
+        size_t read = fread(buffer + used, 1, capacity - used, fp);
+        used += read;
+        short eof = (read == 0) ? 1 : 0;
+        buffer[used] = '\0';
+
+        char* p = buffer;
+        char* last = buffer + used;
+        if (skip == 1) {
+            char* nl = (char*)memchr(p, '\n', used);
+            if (nl == NULL) {
+                done = eof;
+                offset += used;
+                used = 0;
+                continue;
+            }
+            p = nl + 1;
+            skip = 0;
+        }
+        while (p < last) {
+            if (offset + (uint64_t)(p - buffer) >= range->end) {
+                done = 1;
+                break;
+            }
+            char* nl = (char*)memchr(p, '\n', (size_t)(last - p));
+            if (nl == NULL) {
+                if (eof == 0) {
+                    break;  // the rest of the line is not read yet
+                }
+                nl = last;  // final line without a newline
+            }
+            *nl = '\0';
+            if (nl > p && nl[-1] == '\r') {
+                nl[-1] = '\0';
+            }
+            if (*p != '\0') {
+                keys[number_keys++] = p;
+                if (number_keys == BULK_BATCH_SIZE) {
+                    res = __add_keys(cb, keys, &number_keys);
+                }
+            }
+            p = nl + 1;
+        }
+        if (res == COUNTING_BLOOM_SUCCESS) {
+            res = __add_keys(cb, keys, &number_keys);  // the keys point into the buffer
+        }
+        if (done == 1 || eof == 1) {
+            break;
+        }
+        if (p >= last) {
+            offset += used;
+            used = 0;
+            continue;
+        }
+        // keep the partial line; grow the buffer if a single line fills it
+        size_t consumed = (size_t)(p - buffer);
+        memmove(buffer, p, used - consumed);
+        offset += consumed;
+        used -= consumed;
+        if (used == capacity) {
+            char* tmp = (char*)realloc(buffer, capacity * 2 + 1);
+            if (tmp == NULL) {
+                res = COUNTING_BLOOM_FAILURE;
+                break;
+            }
+            buffer = tmp;
+            capacity *= 2;
+        }
+    }
+    free(keys);
+    free(buffer);
+    fclose(fp);
+    return res;
+}
+
+static int __add_keys(CountingBloom* cb, const char** keys, uint64_t* number_keys) {
+    int res = COUNTING_BLOOM_SUCCESS;
+    if (*number_keys > 0) {
+        res = counting_bloom_add_batch(cb, keys, NULL, *number_keys);
+    }
+    *number_keys = 0;
+    return res;
+}
+
+/*
+    Every thread takes part in rounds + 1 steps: in step r the hash threads fill the
+    queues of round r while the apply threads drain the queues of round r - 1, and
+    the barrier at the end of the step hands the queues over.
+*/
+static void* __pipeline_worker(void* arg) {
+    PipelineThread* thread = (PipelineThread*)arg;
+    Pipeline* pipeline = thread->pipeline;
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->state == PIPELINE_WAIT) {
+        pthread_cond_wait(&pipeline->start, &pipeline->lock);
+    }
+    PipelineState state = pipeline->state;
+    pthread_mutex_unlock(&pipeline->lock);
+    if (state == PIPELINE_ABORT) {
+        return NULL;
+    }
+    uint64_t rounds = (pipeline->n + PIPELINE_ROUND_SIZE - 1) / PIPELINE_ROUND_SIZE;
+    short is_hash = (thread->id < pipeline->hash_threads) ? 1 : 0;
+    for (uint64_t r = 0; r <= rounds; ++r) {
+        if (is_hash == 1 && r < rounds) {
+            if (__pipeline_hash(pipeline, thread->id, r) == COUNTING_BLOOM_FAILURE) {
+                __atomic_store_n(&pipeline->res, COUNTING_BLOOM_FAILURE, __ATOMIC_RELAXED);
+            }
+        } else if (is_hash == 0 && r > 0) {
+            __pipeline_apply(pipeline, thread->id - pipeline->hash_threads, r - 1);
+        }
+        pthread_barrier_wait(&pipeline->barrier);
+    }
+    return NULL;
+}
+
+/* Hash this thread's share of the round's keys into the queue of the range that owns each counter */
+static int __pipeline_hash(Pipeline* pipeline, unsigned int h, uint64_t round) {
+    const CountingBloom* cb = pipeline->cb;
+    for (unsigned int a = 0; a < pipeline->apply_threads; ++a) {
+        __pipeline_queue(pipeline, round, h, a)->size = 0;
+    }
+    uint64_t start = round * PIPELINE_ROUND_SIZE;
+    uint64_t count = (pipeline->n - start < PIPELINE_ROUND_SIZE) ? pipeline->n - start : PIPELINE_ROUND_SIZE;
+    uint64_t end = start + count * (h + 1) / pipeline->hash_threads;
+    start += count * h / pipeline->hash_threads;
+
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES], indices[COUNTING_BLOOM_MAX_HASHES], added = 0;
+    int res = COUNTING_BLOOM_SUCCESS;
+    for (uint64_t i = start; i < end; ++i) {
+        int hashed;
+        if (pipeline->lens == NULL) {
+            hashed = counting_bloom_calculate_hashes_into(cb, pipeline->keys[i], cb->number_hashes, hashes);
+        } else {
+            hashed = counting_bloom_calculate_hashes_bytes_into(cb, pipeline->keys[i], pipeline->lens[i], cb->number_hashes, hashes);
+        }
+        if (hashed == COUNTING_BLOOM_FAILURE || counting_bloom_calculate_indices(cb, hashes, cb->number_hashes, indices) == COUNTING_BLOOM_FAILURE) {
+            res = COUNTING_BLOOM_FAILURE;
+            continue;
+        }
+        unsigned int j;
+        for (j = 0; j < cb->number_hashes; ++j) {
+            PipelineQueue* queue = __pipeline_queue(pipeline, round, h, (unsigned int)(indices[j] / pipeline->range_counters));
+            if (__queue_push(queue, indices[j]) == COUNTING_BLOOM_FAILURE) {
+                break;
+            }
+        }
+        if (j < cb->number_hashes) {
+            // take back the key's indices (the last ones pushed) so elements added matches the counters
+            while (j-- > 0) {
+                --__pipeline_queue(pipeline, round, h, (unsigned int)(indices[j] / pipeline->range_counters))->size;
+            }
+            res = COUNTING_BLOOM_FAILURE;
+            break;
+        }
+        ++added;
+    }
+    __atomic_add_fetch(&pipeline->added, added, __ATOMIC_RELAXED);
+    return res;
+}
+
+static void __pipeline_apply(Pipeline* pipeline, unsigned int a, uint64_t round) {
+    for (unsigned int h = 0; h < pipeline->hash_threads; ++h) {
+        const PipelineQueue* queue = __pipeline_queue(pipeline, round, h, a);
+        counting_bloom_add_indices(pipeline->cb, queue->indices, queue->size, 0);
+    }
+}
+
+static __inline__ PipelineQueue* __pipeline_queue(Pipeline* pipeline, uint64_t round, unsigned int h, unsigned int a) {
+    return &pipeline->queues[((round & 1) * pipeline->hash_threads + h) * pipeline->apply_threads + a];
+}
+
+static int __queue_push(PipelineQueue* queue, uint64_t idx) {
+    if (queue->size == queue->capacity) {
+        uint64_t capacity = (queue->capacity == 0) ? 1024 : queue->capacity * 2;
+        uint64_t* tmp = (uint64_t*)realloc(queue->indices, capacity * sizeof(uint64_t));
+        if (tmp == NULL) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+        queue->indices = tmp;
+        queue->capacity = capacity;
+    }
+    queue->indices[queue->size++] = idx;
+    return COUNTING_BLOOM_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#ifndef BARRUST_COUNTING_BLOOM_BULK_H__
+#define BARRUST_COUNTING_BLOOM_BULK_H__
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***	 Purpose: Build or add to a counting bloom from many keys using several
+***	          threads
+***
+***	 License: MIT 2015
+***
+***	 URL:	https://github.com/barrust/counting_bloom
+***
+***	 Usage:
+***        const char* files[] = {"keys-1.txt", "keys-2.txt"};
+***        CountingBloom cb;
+***        counting_bloom_bulk_build(&cb, 2000000000, 0.01, NULL, files, 2, 8);
+***        counting_bloom_pipeline_add(&cb, more_keys, NULL, number_keys, 4, 4);
+***        counting_bloom_export(&cb, "keys.cbm");
+***        counting_bloom_destroy(&cb);
+***
+***	Required Compile Flags: -lm -lpthread
+***
+*******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "counting_bloom.h"
+
+
+/*
+    Initialize cb (as with counting_bloom_init_opts; opts may be NULL) and add every
+    line of the files as a string key; the line ending is not part of the key and
+    empty lines are skipped. The files are split into ranges which number_threads
+    threads take in turn, each adding into a private counting bloom with the same
+    parameters. The private blooms are then merged into cb (see counting_bloom_merge)
+    in parallel pairs so elements added is the total over all of the files.
+
+    NOTE: Each thread past the first holds a full copy of the counters while building
+*/
+int counting_bloom_bulk_build(CountingBloom* cb, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts, const char* const* filepaths, unsigned int number_files, unsigned int number_threads);
+
+/*
+    Add n keys (see counting_bloom_add_batch for keys and lens) to a single counting
+    bloom with a two stage pipeline. hash_threads threads hash the keys and partition
+    the counter indices by counter range into a queue for each of the apply_threads
+    threads; each apply thread owns one range of cb->bloom and increments it without
+    atomics. Keys are processed in rounds so hashing the next round overlaps applying
+    the current one. The counters are the same as adding the keys one at a time.
+    NOTE: If hashing a key fails the other keys are still added; if a queue can not
+          grow the rest of that hash thread's share of the round is skipped. Either
+          way FAILURE is returned and elements added counts exactly the keys that
+          were added
+*/
+int counting_bloom_pipeline_add(CountingBloom* cb, const char* const* keys, const size_t* lens, uint64_t n, unsigned int hash_threads, unsigned int apply_threads);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* END COUNTING BLOOM BULK HEADER */
@@ -0,0 +1,336 @@
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***
+***	 License: MIT 2015
+***
+*******************************************************************************/
+#include <stdlib.h>         /* calloc, malloc, posix_memalign */
+#include <stdio.h>          /* printf, fopen */
+#include <string.h>         /* strlen, memcpy */
+
+#include "counting_bloom_sharded.h"
+
+static const uint32_t SHARDED_MAGIC = 0x43424c53;  // 'CBLS'
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+static void __init_default_options(CountingBloomOptions* opts, const CountingBloomOptions* passed);
+static int __allocate_shards(CountingBloomSharded* cbs, unsigned int number_shards);
+static void __free_shards(CountingBloomSharded* cbs, unsigned int initialized);
+static int __find_shard(const CountingBloomSharded* cbs, const void* key, size_t len, short is_string, uint64_t* hashes);
+static int __add(CountingBloomSharded* cbs, const void* key, size_t len, short is_string);
+static int __check(CountingBloomSharded* cbs, const void* key, size_t len, short is_string);
+static int __get_max_insertions(CountingBloomSharded* cbs, const void* key, size_t len, short is_string);
+static int __remove(CountingBloomSharded* cbs, const void* key, size_t len, short is_string);
+static char* __shard_path(const char* filepath, unsigned int shard);
+
+
+/*******************************************************************************
+***		PUBLIC FUNCTION DECLARATIONS
+*******************************************************************************/
+int counting_bloom_sharded_init(CountingBloomSharded* cbs, unsigned int number_shards, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts) {
+    if (number_shards == 0 || number_shards > COUNTING_BLOOM_MAX_SHARDS || estimated_elements == 0) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    CountingBloomOptions options;
+    __init_default_options(&options, opts);
+    if (__allocate_shards(cbs, number_shards) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint64_t per_shard = (estimated_elements + number_shards - 1) / number_shards;
+    for (unsigned int i = 0; i < number_shards; ++i) {
+        if (counting_bloom_init_opts(&cbs->shards[i], per_shard, false_positive_rate, &options) == COUNTING_BLOOM_FAILURE) {
+            __free_shards(cbs, i);
+            return COUNTING_BLOOM_FAILURE;
+        }
+    }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_sharded_destroy(CountingBloomSharded* cbs) {
+    __free_shards(cbs, cbs->number_shards);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_sharded_place(CountingBloomSharded* cbs, unsigned int shard) {
+    if (shard >= cbs->number_shards) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    CountingBloom* cb = &cbs->shards[shard];
+    if (cb->__is_on_disk == 1) {
+        return COUNTING_BLOOM_FAILURE;  // the page cache decides where mmapped pages live
+    }
+    uint64_t bytes = counting_bloom_counter_bytes(cb);
+    void* counters = NULL;
+    if (posix_memalign(&counters, (cb->block_size > 64) ? cb->block_size : 64, bytes) != 0) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    pthread_rwlock_wrlock(&cbs->locks[shard]);
+    memcpy(counters, cb->bloom, bytes);  // first touch from this thread
+    free(cb->bloom);
+    cb->bloom = (uint32_t*)counters;
+    pthread_rwlock_unlock(&cbs->locks[shard]);
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+unsigned int counting_bloom_sharded_shard(const CountingBloomSharded* cbs, const uint64_t* hashes) {
+    /*  The shards index with the same hashes, from either their low (modulo) or high
+        (fastrange) bits, so picking the shard from any bits of the hash would leave
+        each shard using only part of its counters; pick it from a remix instead. The
+        remix is offset (the next splitmix64 step) so it stays independent of any
+        remix of hashes[0] made inside the shard */
+    uint64_t mixed = counting_bloom_mix_64(hashes[0] + 0x9E3779B97F4A7C15ULL);
+    return (unsigned int)(((mixed >> 32) * cbs->number_shards) >> 32);
+}
+
+int counting_bloom_sharded_add_string(CountingBloomSharded* cbs, const char* key) {
+    return __add(cbs, key, strlen(key), 1);
+}
+
+int counting_bloom_sharded_add_bytes(CountingBloomSharded* cbs, const void* key, size_t len) {
+    return __add(cbs, key, len, 0);
+}
+
+int counting_bloom_sharded_check_string(CountingBloomSharded* cbs, const char* key) {
+    return __check(cbs, key, strlen(key), 1);
+}
+
+int counting_bloom_sharded_check_bytes(CountingBloomSharded* cbs, const void* key, size_t len) {
+    return __check(cbs, key, len, 0);
+}
+
+int counting_bloom_sharded_get_max_insertions(CountingBloomSharded* cbs, const char* key) {
+    return __get_max_insertions(cbs, key, strlen(key), 1);
+}
+
+int counting_bloom_sharded_get_max_insertions_bytes(CountingBloomSharded* cbs, const void* key, size_t len) {
+    return __get_max_insertions(cbs, key, len, 0);
+}
+
+int counting_bloom_sharded_remove_string(CountingBloomSharded* cbs, const char* key) {
+    return __remove(cbs, key, strlen(key), 1);
+}
+
+int counting_bloom_sharded_remove_bytes(CountingBloomSharded* cbs, const void* key, size_t len) {
+    return __remove(cbs, key, len, 0);
+}
+
+uint64_t counting_bloom_sharded_elements_added(CountingBloomSharded* cbs) {
+    uint64_t res = 0;
+    for (unsigned int i = 0; i < cbs->number_shards; ++i) {
+        pthread_rwlock_rdlock(&cbs->locks[i]);
+        res += cbs->shards[i].elements_added;
+        pthread_rwlock_unlock(&cbs->locks[i]);
+    }
+    return res;
+}
+
+void counting_bloom_sharded_stats(CountingBloomSharded* cbs) {
+    uint64_t bits = 0, estimated_elements = 0, elements_added = 0, set_bits = 0;
+    double current_fpr = 0.0;
+    for (unsigned int i = 0; i < cbs->number_shards; ++i) {
+        pthread_rwlock_rdlock(&cbs->locks[i]);
+        const CountingBloom* cb = &cbs->shards[i];
+        bits += cb->number_bits;
+        estimated_elements += cb->estimated_elements;
+        elements_added += cb->elements_added;
+        set_bits += counting_bloom_count_set_bits(cb);
+        current_fpr += counting_bloom_current_false_positive_rate(cb);
+        pthread_rwlock_unlock(&cbs->locks[i]);
+    }
+    // keys are spread evenly over the shards so the rate is the average of the shards
+    current_fpr /= cbs->number_shards;
+    printf("CountingBloomSharded\n\
+    shards: %u\n\
+    bits: %" PRIu64 "\n\
+    estimated elements: %" PRIu64 "\n\
+    number hashes: %d\n\
+    max false positive rate: %f\n\
+    elements added: %" PRIu64 "\n\
+    current false positive rate: %f\n\
+    index fullness: %f\n",
+    cbs->number_shards, bits, estimated_elements, cbs->shards[0].number_hashes,
+    cbs->shards[0].false_positive_probability, elements_added, current_fpr,
+    (float)set_bits / bits);
+}
+
+int counting_bloom_sharded_export(CountingBloomSharded* cbs, const char* filepath) {
+    FILE* fp;
+    fp = fopen(filepath, "w+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    fwrite(&SHARDED_MAGIC, sizeof(uint32_t), 1, fp);
+    fwrite(&cbs->number_shards, sizeof(uint32_t), 1, fp);
+    fclose(fp);
+
+    int res = COUNTING_BLOOM_SUCCESS;
+    for (unsigned int i = 0; i < cbs->number_shards && res == COUNTING_BLOOM_SUCCESS; ++i) {
+        char* path = __shard_path(filepath, i);
+        if (path == NULL) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+        pthread_rwlock_rdlock(&cbs->locks[i]);
+        res = counting_bloom_export(&cbs->shards[i], path);
+        pthread_rwlock_unlock(&cbs->locks[i]);
+        free(path);
+    }
+    return res;
+}
+
+int counting_bloom_sharded_import(CountingBloomSharded* cbs, const char* filepath, const CountingBloomOptions* opts) {
+    FILE* fp;
+    fp = fopen(filepath, "r+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    uint32_t magic = 0, number_shards = 0;
+    size_t read = fread(&magic, sizeof(uint32_t), 1, fp);
+    read += fread(&number_shards, sizeof(uint32_t), 1, fp);
+    fclose(fp);
+    if (read != 2 || magic != SHARDED_MAGIC || number_shards == 0 || number_shards > COUNTING_BLOOM_MAX_SHARDS) {
+        fprintf(stderr, "%s is not a sharded counting bloom!\n", filepath);
+        return COUNTING_BLOOM_FAILURE;
+    }
+
+    CountingBloomOptions options;
+    __init_default_options(&options, opts);
+    if (__allocate_shards(cbs, number_shards) == COUNTING_BLOOM_FAILURE) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    for (unsigned int i = 0; i < number_shards; ++i) {
+        char* path = __shard_path(filepath, i);
+        if (path == NULL || counting_bloom_import_opts(&cbs->shards[i], path, &options) == COUNTING_BLOOM_FAILURE) {
+            free(path);
+            __free_shards(cbs, i);
+            return COUNTING_BLOOM_FAILURE;
+        }
+        free(path);
+    }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+static void __init_default_options(CountingBloomOptions* opts, const CountingBloomOptions* passed) {
+    if (passed == NULL) {
+        counting_bloom_options_init(opts);
+    } else {
+        memcpy(opts, passed, sizeof(CountingBloomOptions));
+    }
+}
+
+static int __allocate_shards(CountingBloomSharded* cbs, unsigned int number_shards) {
+    cbs->number_shards = number_shards;
+    cbs->shards = (CountingBloom*)calloc(number_shards, sizeof(CountingBloom));
+    cbs->locks = (pthread_rwlock_t*)calloc(number_shards, sizeof(pthread_rwlock_t));
+    if (cbs->shards == NULL || cbs->locks == NULL) {
+        free(cbs->shards);
+        free(cbs->locks);
+        cbs->shards = NULL;
+        cbs->locks = NULL;
+        cbs->number_shards = 0;
+        return COUNTING_BLOOM_FAILURE;
+    }
+    for (unsigned int i = 0; i < number_shards; ++i) {
+        pthread_rwlock_init(&cbs->locks[i], NULL);
+    }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/* destroy the first initialized shards and release the rest of the container */
+static void __free_shards(CountingBloomSharded* cbs, unsigned int initialized) {
+    for (unsigned int i = 0; i < cbs->number_shards; ++i) {
+        if (i < initialized) {
+            counting_bloom_destroy(&cbs->shards[i]);
+        }
+        pthread_rwlock_destroy(&cbs->locks[i]);
+    }
+    free(cbs->shards);
+    free(cbs->locks);
+    cbs->shards = NULL;
+    cbs->locks = NULL;
+    cbs->number_shards = 0;
+}
+
+/* All shards share the hash functions so the first shard hashes for all of them */
+static int __find_shard(const CountingBloomSharded* cbs, const void* key, size_t len, short is_string, uint64_t* hashes) {
+    const CountingBloom* cb = &cbs->shards[0];
+    int res;
+    if (is_string == 1) {
+        res = counting_bloom_calculate_hashes_into(cb, (const char*)key, cb->number_hashes, hashes);
+    } else {
+        res = counting_bloom_calculate_hashes_bytes_into(cb, key, len, cb->number_hashes, hashes);
+    }
+    if (res == COUNTING_BLOOM_FAILURE) {
+        return -1;
+    }
+    return (int)counting_bloom_sharded_shard(cbs, hashes);
+}
+
+static int __add(CountingBloomSharded* cbs, const void* key, size_t len, short is_string) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    int shard = __find_shard(cbs, key, len, is_string, hashes);
+    if (shard == -1) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    pthread_rwlock_wrlock(&cbs->locks[shard]);
+    int res = counting_bloom_add_string_alt(&cbs->shards[shard], hashes, cbs->shards[shard].number_hashes);
+    pthread_rwlock_unlock(&cbs->locks[shard]);
+    return res;
+}
+
+static int __check(CountingBloomSharded* cbs, const void* key, size_t len, short is_string) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    int shard = __find_shard(cbs, key, len, is_string, hashes);
+    if (shard == -1) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    pthread_rwlock_rdlock(&cbs->locks[shard]);
+    int res = counting_bloom_check_string_alt(&cbs->shards[shard], hashes, cbs->shards[shard].number_hashes);
+    pthread_rwlock_unlock(&cbs->locks[shard]);
+    return res;
+}
+
+static int __get_max_insertions(CountingBloomSharded* cbs, const void* key, size_t len, short is_string) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    int shard = __find_shard(cbs, key, len, is_string, hashes);
+    if (shard == -1) {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&cbs->locks[shard]);
+    int res = counting_bloom_get_max_insertions_alt(&cbs->shards[shard], hashes, cbs->shards[shard].number_hashes);
+    pthread_rwlock_unlock(&cbs->locks[shard]);
+    return res;
+}
+
+static int __remove(CountingBloomSharded* cbs, const void* key, size_t len, short is_string) {
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES];
+    int shard = __find_shard(cbs, key, len, is_string, hashes);
+    if (shard == -1) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    pthread_rwlock_wrlock(&cbs->locks[shard]);
+    int res = counting_bloom_remove_string_alt(&cbs->shards[shard], hashes, cbs->shards[shard].number_hashes);
+    pthread_rwlock_unlock(&cbs->locks[shard]);
+    return res;
+}
+
+
+static char* __shard_path(const char* filepath, unsigned int shard) {
+    size_t len = strlen(filepath) + 12;  // '.', up to 10 digits, and the NULL
+    char* path = (char*)malloc(len);
+    if (path != NULL) {
+        snprintf(path, len, "%s.%u", filepath, shard);
+    }
+    return path;
+}
@@ -0,0 +1,119 @@
+#ifndef BARRUST_COUNTING_BLOOM_SHARDED_H__
+#define BARRUST_COUNTING_BLOOM_SHARDED_H__
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***	 Purpose: Counting bloom filter split into independently locked shards so
+***	          that several threads can add to it at once
+***
+***	 License: MIT 2015
+***
+***	 URL:	https://github.com/barrust/counting_bloom
+***
+***	 Usage:
+***        CountingBloomSharded cbs;
+***        counting_bloom_sharded_init(&cbs, 8, 1000000, 0.01, NULL);
+***        // in each worker thread (optional; places the shard on the thread's NUMA node)
+***        counting_bloom_sharded_place(&cbs, thread_id);
+***        counting_bloom_sharded_add_string(&cbs, "google");
+***        if (counting_bloom_sharded_check_string(&cbs, "google") == COUNTING_BLOOM_SUCCESS) {
+***            printf("'google' is in the counting bloom!\n");
+***        }
+***        counting_bloom_sharded_stats(&cbs);
+***        counting_bloom_sharded_destroy(&cbs);
+***
+***	Required Compile Flags: -lm -lpthread
+***
+*******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+
+#include "counting_bloom.h"
+
+/* Upper bound on the number of shards; also bounds what an imported file may ask for */
+#define COUNTING_BLOOM_MAX_SHARDS 4096
+
+
+/*
+    Each key belongs to exactly one shard, picked from a remix of its first hash
+    (the shards index with the hashes themselves), and each shard is an ordinary
+    CountingBloom sized for its share of the estimated elements with the same
+    false positive rate. A shard has its own reader / writer lock so adds to
+    different shards do not contend.
+*/
+typedef struct counting_bloom_sharded {
+    unsigned int number_shards;
+    CountingBloom* shards;
+    pthread_rwlock_t* locks;
+} CountingBloomSharded;
+
+/*  Initialize number_shards shards; opts may be NULL to use the defaults. The
+    options apply to every shard (e.g., counter_width) */
+int counting_bloom_sharded_init(CountingBloomSharded* cbs, unsigned int number_shards, uint64_t estimated_elements, float false_positive_rate, const CountingBloomOptions* opts);
+
+/* Release all memory allocated for the shards */
+int counting_bloom_sharded_destroy(CountingBloomSharded* cbs);
+
+/*
+    Move the shard's counters into memory first touched by the calling thread. With
+    the default (first touch) NUMA policy this places the shard on the node of the
+    thread that owns it; call it from that thread before adding.
+*/
+int counting_bloom_sharded_place(CountingBloomSharded* cbs, unsigned int shard);
+
+/* Index of the shard that holds the element with the passed hashes */
+unsigned int counting_bloom_sharded_shard(const CountingBloomSharded* cbs, const uint64_t* hashes);
+
+/* Add a string (or element) to the sharded counting bloom */
+int counting_bloom_sharded_add_string(CountingBloomSharded* cbs, const char* key);
+
+/* Add a key of len bytes to the sharded counting bloom */
+int counting_bloom_sharded_add_bytes(CountingBloomSharded* cbs, const void* key, size_t len);
+
+/* Check to see if a string (or element) is or is not in the sharded counting bloom */
+int counting_bloom_sharded_check_string(CountingBloomSharded* cbs, const char* key);
+
+/* Check to see if a key of len bytes is or is not in the sharded counting bloom */
+int counting_bloom_sharded_check_bytes(CountingBloomSharded* cbs, const void* key, size_t len);
+
+/* Determine the maximum number of times a string could have been inserted */
+int counting_bloom_sharded_get_max_insertions(CountingBloomSharded* cbs, const char* key);
+
+/* Determine the maximum number of times a key of len bytes could have been inserted */
+int counting_bloom_sharded_get_max_insertions_bytes(CountingBloomSharded* cbs, const void* key, size_t len);
+
+/* Remove a string from the sharded counting bloom */
+int counting_bloom_sharded_remove_string(CountingBloomSharded* cbs, const char* key);
+
+/* Remove a key of len bytes from the sharded counting bloom */
+int counting_bloom_sharded_remove_bytes(CountingBloomSharded* cbs, const void* key, size_t len);
+
+/* Total number of elements added across all shards */
+uint64_t counting_bloom_sharded_elements_added(CountingBloomSharded* cbs);
+
+/* Print out statistics about the sharded counting bloom, totaled across shards */
+void counting_bloom_sharded_stats(CountingBloomSharded* cbs);
+
+/*
+    Export the sharded counting bloom. The file at filepath holds the number of
+    shards and each shard is exported, as a regular counting bloom file, to
+    filepath.0, filepath.1, ...
+*/
+int counting_bloom_sharded_export(CountingBloomSharded* cbs, const char* filepath);
+
+/* Import a previously exported sharded counting bloom; opts may be NULL */
+int counting_bloom_sharded_import(CountingBloomSharded* cbs, const char* filepath, const CountingBloomOptions* opts);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* END COUNTING BLOOM SHARDED HEADER */
@@ -0,0 +1,142 @@
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***
+***	 License: MIT 2015
+***
+*******************************************************************************/
+#include <stdlib.h>         /* calloc, posix_memalign */
+#include <stdio.h>          /* FILE */
+#include <string.h>         /* memcpy, memset */
+
+#include "counting_bloom_snapshot.h"
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+static CountingBloom* __free_buffer(CountingBloomSnapshots* snaps);
+static int __is_held(const CountingBloomSnapshots* snaps, const CountingBloom* buffer);
+
+
+/*******************************************************************************
+***		PUBLIC FUNCTION DECLARATIONS
+*******************************************************************************/
+int counting_bloom_snapshots_init(CountingBloomSnapshots* snaps, CountingBloom* cb, unsigned int number_readers) {
+    snaps->cb = cb;
+    snaps->current = NULL;
+    snaps->generation = 0;
+    snaps->number_readers = number_readers;
+    snaps->number_buffers = number_readers + 2;
+    snaps->buffers = (CountingBloom*)calloc(snaps->number_buffers, sizeof(CountingBloom));
+    void* readers = NULL;  // one extra so that there is an allocation with no readers
+    if (snaps->buffers == NULL || posix_memalign(&readers, COUNTING_BLOOM_CACHE_LINE_SIZE, (number_readers + 1) * sizeof(CountingBloomSnapshotReader)) != 0) {
+        free(snaps->buffers);
+        snaps->buffers = NULL;
+        return COUNTING_BLOOM_FAILURE;
+    }
+    snaps->readers = (CountingBloomSnapshotReader*)readers;
+    memset(snaps->readers, 0, (number_readers + 1) * sizeof(CountingBloomSnapshotReader));
+    if (counting_bloom_snapshots_publish(snaps) == COUNTING_BLOOM_FAILURE) {
+        counting_bloom_snapshots_destroy(snaps);
+        return COUNTING_BLOOM_FAILURE;
+    }
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_snapshots_destroy(CountingBloomSnapshots* snaps) {
+    for (unsigned int i = 0; i < snaps->number_buffers; ++i) {
+        free(snaps->buffers[i].bloom);
+    }
+    free(snaps->buffers);
+    free(snaps->readers);
+    snaps->cb = NULL;
+    snaps->current = NULL;
+    snaps->generation = 0;
+    snaps->number_readers = 0;
+    snaps->number_buffers = 0;
+    snaps->buffers = NULL;
+    snaps->readers = NULL;
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+int counting_bloom_snapshots_publish(CountingBloomSnapshots* snaps) {
+    CountingBloom* buffer = __free_buffer(snaps);
+    if (buffer == NULL) {
+        return COUNTING_BLOOM_FAILURE;
+    }
+    const CountingBloom* cb = snaps->cb;
+    uint32_t* counters = buffer->bloom;
+    if (counters == NULL) {
+        void* tmp = NULL;
+        size_t alignment = (cb->block_size > COUNTING_BLOOM_CACHE_LINE_SIZE) ? cb->block_size : COUNTING_BLOOM_CACHE_LINE_SIZE;
+        if (posix_memalign(&tmp, alignment, counting_bloom_counter_bytes(cb)) != 0) {
+            return COUNTING_BLOOM_FAILURE;
+        }
+        counters = (uint32_t*)tmp;
+    }
+    // the snapshot has all of the parameters and hash functions of the writer's bloom
+    memcpy(buffer, cb, sizeof(CountingBloom));
+    memcpy(counters, cb->bloom, counting_bloom_counter_bytes(cb));
+    buffer->bloom = counters;
+    buffer->concurrent = 0;
+    buffer->__is_on_disk = 0;
+    buffer->__filesize = 0;
+    buffer->filepointer = NULL;
+    if (cb->__shared_elements_added != NULL) {  // a private copy of a shared memory bloom
+        buffer->elements_added = __atomic_load_n(cb->__shared_elements_added, __ATOMIC_RELAXED);
+    }
+    buffer->__mapping = NULL;
+    buffer->__shared_elements_added = NULL;
+
+    __atomic_store_n(&snaps->current, buffer, __ATOMIC_SEQ_CST);
+    ++snaps->generation;
+    return COUNTING_BLOOM_SUCCESS;
+}
+
+/*
+    Hazard pointer acquire: announce the snapshot and then make sure it is still the
+    current one; if it is, the writer saw the announcement (or had not retired the
+    snapshot yet) and will not reuse it until it is released.
+*/
+const CountingBloom* counting_bloom_snapshots_acquire(CountingBloomSnapshots* snaps, unsigned int reader) {
+    CountingBloom* snapshot;
+    do {
+        snapshot = __atomic_load_n(&snaps->current, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&snaps->readers[reader].snapshot, snapshot, __ATOMIC_SEQ_CST);
+    } while (snapshot != __atomic_load_n(&snaps->current, __ATOMIC_SEQ_CST));
+    return snapshot;
+}
+
+void counting_bloom_snapshots_release(CountingBloomSnapshots* snaps, unsigned int reader) {
+    __atomic_store_n(&snaps->readers[reader].snapshot, (CountingBloom*)NULL, __ATOMIC_RELEASE);
+}
+
+
+/*******************************************************************************
+***		PRIVATE FUNCTIONS
+*******************************************************************************/
+/* A buffer that is not the current snapshot or held by a reader; one always exists */
+static CountingBloom* __free_buffer(CountingBloomSnapshots* snaps) {
+    CountingBloom* unallocated = NULL;
+    for (unsigned int i = 0; i < snaps->number_buffers; ++i) {
+        CountingBloom* buffer = &snaps->buffers[i];
+        if (buffer->bloom == NULL) {
+            unallocated = (unallocated == NULL) ? buffer : unallocated;
+        } else if (buffer != snaps->current && __is_held(snaps, buffer) == 0) {
+            return buffer;
+        }
+    }
+    return unallocated;
+}
+
+static int __is_held(const CountingBloomSnapshots* snaps, const CountingBloom* buffer) {
+    for (unsigned int i = 0; i < snaps->number_readers; ++i) {
+        if (__atomic_load_n(&snaps->readers[i].snapshot, __ATOMIC_SEQ_CST) == buffer) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef BARRUST_COUNTING_BLOOM_SNAPSHOT_H__
+#define BARRUST_COUNTING_BLOOM_SNAPSHOT_H__
+/*******************************************************************************
+***
+***	 Author: Tyler Barrus
+***	 email:  barrust@gmail.com
+***
+***	 Version: 1.2.0
+***	 Purpose: Publish read only copies of a counting bloom so that reader threads
+***	          can query it without locks while a single writer keeps changing it
+***
+***	 License: MIT 2015
+***
+***	 URL:	https://github.com/barrust/counting_bloom
+***
+***	 Usage:
+***        CountingBloomSnapshots snaps;
+***        counting_bloom_snapshots_init(&snaps, &cb, 4);
+***        // writer thread
+***        counting_bloom_add_string(&cb, "google");
+***        counting_bloom_snapshots_publish(&snaps);
+***        // reader thread 2
+***        const CountingBloom* snap = counting_bloom_snapshots_acquire(&snaps, 2);
+***        if (counting_bloom_check_string(snap, "google") == COUNTING_BLOOM_SUCCESS) {
+***            printf("'google' is in the snapshot!\n");
+***        }
+***        counting_bloom_snapshots_release(&snaps, 2);
+***        counting_bloom_snapshots_destroy(&snaps);
+***
+***	Required Compile Flags: -lm
+***
+*******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "counting_bloom.h"
+
+
+/* A reader's hazard pointer; padded to a cache line so readers do not share one */
+typedef struct {
+    CountingBloom* snapshot;
+    char __padding[COUNTING_BLOOM_CACHE_LINE_SIZE - sizeof(CountingBloom*)];
+} CountingBloomSnapshotReader;
+
+/*
+    Snapshots are full copies of the counters, double buffered: publish copies the
+    writer's counting bloom into a buffer that is neither the current snapshot nor
+    held by a reader and then swaps it in. Each reader announces the snapshot it
+    holds (a hazard pointer) so a buffer is never reused while it is being read;
+    with number_readers + 2 buffers one is always free, so neither readers nor the
+    writer ever wait. Buffers past the first two are only allocated when readers
+    hold on to old snapshots.
+*/
+typedef struct counting_bloom_snapshots {
+    CountingBloom* cb;
+    CountingBloom* current;
+    uint64_t generation;
+    unsigned int number_readers;
+    unsigned int number_buffers;
+    CountingBloom* buffers;
+    CountingBloomSnapshotReader* readers;
+} CountingBloomSnapshots;
+
+/* Set up snapshots of cb for number_readers reader threads and publish the first one */
+int counting_bloom_snapshots_init(CountingBloomSnapshots* snaps, CountingBloom* cb, unsigned int number_readers);
+
+/* Release the snapshot buffers; cb is not changed. No reader may hold a snapshot */
+int counting_bloom_snapshots_destroy(CountingBloomSnapshots* snaps);
+
+/*
+    Copy the current counters and elements added of cb into a new snapshot and make
+    it the current one. Only the writer (the thread changing cb) may call this.
+*/
+int counting_bloom_snapshots_publish(CountingBloomSnapshots* snaps);
+
+/*
+    Get the current snapshot for reader (0 to number_readers - 1). The snapshot does
+    not change until it is released and may be passed to any of the functions that
+    take a const CountingBloom*. Each reader holds at most one snapshot at a time.
+*/
+const CountingBloom* counting_bloom_snapshots_acquire(CountingBloomSnapshots* snaps, unsigned int reader);
+
+/* Let the writer reuse the snapshot held by reader */
+void counting_bloom_snapshots_release(CountingBloomSnapshots* snaps, unsigned int reader);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* END COUNTING BLOOM SNAPSHOT HEADER */
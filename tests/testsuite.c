@@ -1,16 +1,52 @@
 #include <stdlib.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <openssl/evp.h>
 #include <openssl/md5.h>
 
 #include "minunit.h"
 #include "../src/counting_bloom.h"
+#include "../src/counting_bloom_sharded.h"
+#include "../src/counting_bloom_bulk.h"
+#include "../src/counting_bloom_snapshot.h"
 
 
 static int calculate_md5sum(const char* filename, char* digest);
 static off_t fsize(const char* filename);
+static uint64_t* legacy_hash(int num_hashes, const char* str);
+static void legacy_hash_into(int num_hashes, const char* str, uint64_t* results);
+static void* concurrent_add(void* arg);
+static void* concurrent_remove(void* arg);
+static void* sharded_add(void* arg);
+static void* snapshot_reader(void* arg);
+static void* deltas_add(void* arg);
+
+#define STRESS_THREADS 4
+#define STRESS_KEYS 2000
+
+typedef struct {
+    CountingBloom* bf;
+    int thread;
+    int errors;
+} StressArgs;
+
+typedef struct {
+    CountingBloomSharded* cbs;
+    int thread;
+    int errors;
+} ShardedArgs;
+
+typedef struct {
+    CountingBloomSnapshots* snaps;
+    unsigned int reader;
+    short* done;
+    int errors;
+    int reads;
+} SnapshotArgs;
 
 CountingBloom cb;
 
@@ -79,6 +115,56 @@ MU_TEST(test_bloom_on_disk_setup_returns) {
     remove(filepath);
 }
 
+MU_TEST(test_bloom_on_disk_setup_preallocate) {
+    char filepath[] = "./dist/test_bloom_on_disk_setup_preallocate.blm";
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    off_t size = 0;
+    for (short preallocate = 0; preallocate <= 1; ++preallocate) {
+        CountingBloom bf;
+        opts.preallocate = preallocate;
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_on_disk_opts(&bf, 500000, 0.01, filepath, &opts));
+        struct stat st;
+        stat(filepath, &st);
+        mu_assert(st.st_size > (off_t)(bf.number_bits * sizeof(uint32_t)), "Expected the file to hold the counters");
+        if (preallocate == 0) {
+            size = st.st_size;
+        } else {
+            mu_assert_int_eq(size, st.st_size);
+            mu_assert(st.st_blocks * 512 >= st.st_size, "Expected the file to be preallocated");
+        }
+        // the counters start cleared
+        mu_assert_int_eq(0, counting_bloom_count_set_bits(&bf));
+        counting_bloom_add_string(&bf, "google");
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&bf, "google"));
+        counting_bloom_destroy(&bf);
+        remove(filepath);
+    }
+}
+
+MU_TEST(test_bloom_on_disk_elements_added) {
+    char filepath[] = "./dist/test_bloom_on_disk_elements_added.blm";
+    CountingBloom bf, res;
+    counting_bloom_init_on_disk(&bf, 50000, 0.01, filepath);
+    for (int i = 0; i < 1000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_remove_string(&bf, "999");
+    // the trailer is kept in the mapping so the file is current before destroy
+    counting_bloom_import(&res, filepath);
+    mu_assert_int_eq(999, res.elements_added);
+    mu_assert_int_eq(0, memcmp(bf.bloom, res.bloom, res.number_bits * sizeof(uint32_t)));
+    counting_bloom_destroy(&res);
+    counting_bloom_clear(&bf);
+    counting_bloom_import(&res, filepath);
+    mu_assert_int_eq(0, res.elements_added);
+    counting_bloom_destroy(&res);
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
 /*******************************************************************************
 *   Test hashing
 *******************************************************************************/
@@ -102,6 +188,155 @@ MU_TEST(test_bloom_hashes_start_collisions) {
     free(hashes_bar);
 }
 
+MU_TEST(test_bloom_hashes_into) {
+    uint64_t vals[] = {15902901984413996407ULL, 13757982394814800524ULL, 14025518860217559917ULL, 5646210032526140290ULL, 6127913770875964707ULL};
+    uint64_t hashes[5] = {0};
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_calculate_hashes_into(&cb, "foo", 5, hashes));
+    for (int i = 0; i < 5; ++i)
+        mu_assert_int_eq(vals[i], hashes[i]);
+}
+
+MU_TEST(test_bloom_hashes_many_seeds) {
+    // more hashes than are computed together must still match FNV-1a with each seed
+    const char* keys[] = {"", "foo", "this is a longer key to hash"};
+    uint64_t hashes[COUNTING_BLOOM_MAX_HASHES + 44] = {0};
+    int counts[] = {9, 20, COUNTING_BLOOM_MAX_HASHES, COUNTING_BLOOM_MAX_HASHES + 44};
+    for (int k = 0; k < 3; ++k) {
+        for (int c = 0; c < 4; ++c) {
+            mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_calculate_hashes_into(&cb, keys[k], counts[c], hashes));
+            for (int i = 0; i < counts[c]; ++i) {
+                uint64_t h = 14695981039346656037ULL + (31 * i);
+                for (size_t j = 0; j < strlen(keys[k]); ++j)
+                    h = (h ^ (unsigned char)keys[k][j]) * 1099511628211ULL;
+                mu_assert_int_eq(h, hashes[i]);
+            }
+        }
+    }
+    // the allocating version has no limit on the number of hashes either
+    uint64_t* many = counting_bloom_calculate_hashes(&cb, "foo", COUNTING_BLOOM_MAX_HASHES + 44);
+    mu_assert_not_null(many);
+    counting_bloom_calculate_hashes_into(&cb, "foo", COUNTING_BLOOM_MAX_HASHES + 44, hashes);
+    for (int i = 0; i < COUNTING_BLOOM_MAX_HASHES + 44; ++i)
+        mu_assert_int_eq(hashes[i], many[i]);
+    free(many);
+}
+
+MU_TEST(test_bloom_hashes_into_legacy_adapter) {
+    CountingBloom bf;
+    counting_bloom_init_alt(&bf, 50000, 0.01, &legacy_hash);
+    mu_assert_null(bf.hash_function_into);
+
+    uint64_t hashes[7] = {0};
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_calculate_hashes_into(&bf, "foo", 7, hashes));
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_eq(i + 3, hashes[i]);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_string(&bf, "foo"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&bf, "foo"));
+    mu_assert_int_eq(1, counting_bloom_get_max_insertions(&bf, "foo"));
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_hashes_into_options) {
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_function_into = &legacy_hash_into;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+    mu_assert_null(bf.hash_function);
+
+    uint64_t* hashes = counting_bloom_calculate_hashes(&bf, "foo", 7);
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_eq(i + 3, hashes[i]);
+    free(hashes);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_string(&bf, "foo"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&bf, "foo"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_string(&bf, "foo"));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(&bf, "foo"));
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_hashes_double) {
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_mode = COUNTING_BLOOM_HASH_DOUBLE;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+    mu_assert_int_eq(COUNTING_BLOOM_HASH_DOUBLE, bf.hash_mode);
+
+    uint64_t base[2], hashes[7];
+    counting_bloom_calculate_hashes_into(&cb, "foo", 2, base);
+    counting_bloom_calculate_hashes_into(&bf, "foo", 7, hashes);
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_eq(base[0] + i * base[1], hashes[i]);
+
+    uint64_t* alloc_hashes = counting_bloom_calculate_hashes(&bf, "foo", 7);
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_eq(hashes[i], alloc_hashes[i]);
+    free(alloc_hashes);
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_hashes_bytes) {
+    uint64_t string_hashes[7], bytes_hashes[7];
+    counting_bloom_calculate_hashes_into(&cb, "foo", 7, string_hashes);
+    counting_bloom_calculate_hashes_bytes_into(&cb, "foobar", 3, 7, bytes_hashes);
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_eq(string_hashes[i], bytes_hashes[i]);
+
+    // embedded NUL bytes are part of the key
+    counting_bloom_calculate_hashes_bytes_into(&cb, "foo\0bar", 7, 7, bytes_hashes);
+    for (int i = 0; i < 7; ++i)
+        mu_assert_int_not_eq(string_hashes[i], bytes_hashes[i]);
+}
+
+MU_TEST(test_bloom_hashes_bytes_string_adapter) {
+    // string hash functions are passed a NUL terminated copy of the key
+    CountingBloom bf;
+    counting_bloom_init_alt(&bf, 50000, 0.01, &legacy_hash);
+    char key[300] = {0};
+    memset(key, 'a', 299);
+    uint64_t hashes[7];
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_calculate_hashes_bytes_into(&bf, key, 3, 7, hashes));
+    mu_assert_int_eq(3, hashes[0]);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_calculate_hashes_bytes_into(&bf, key, 299, 7, hashes));
+    mu_assert_int_eq(299, hashes[0]);
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_hashes_builtin) {
+    CountingBloomHashType types[] = {COUNTING_BLOOM_HASH_TYPE_WYHASH, COUNTING_BLOOM_HASH_TYPE_CRC32C};
+    uint64_t vals[][2] = {{8671910288633948281ULL, 4958693813701419972ULL}, {9403146274478391315ULL, 14251742163329532434ULL}};
+    for (int t = 0; t < 2; ++t) {
+        CountingBloom bf;
+        CountingBloomOptions opts;
+        counting_bloom_options_init(&opts);
+        opts.hash_type = types[t];
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+        mu_assert_not_null(bf.hash_function_bytes);
+
+        uint64_t hashes[2];
+        counting_bloom_calculate_hashes_into(&bf, "foo", 2, hashes);
+        mu_assert_int_eq(vals[t][0], hashes[0]);
+        mu_assert_int_eq(vals[t][1], hashes[1]);
+
+        // every length through the 8 and 16 byte blocks
+        char key[100] = {0};
+        int errors = 0;
+        for (int i = 0; i < 99; ++i) {
+            key[i] = 'a' + (i % 26);
+            errors += counting_bloom_add_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        for (int i = 98; i >= 0; --i) {
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+            key[i] = '\0';
+        }
+        mu_assert_int_eq(0, errors);
+        counting_bloom_destroy(&bf);
+    }
+}
+
 /*******************************************************************************
 *   Test set and check
 *******************************************************************************/
@@ -124,6 +359,1016 @@ MU_TEST(test_bloom_set) {
     mu_assert_int_eq(0, errors);
 }
 
+MU_TEST(test_bloom_bytes) {
+    int errors = 0;
+    for (uint32_t i = 0; i < 3000; ++i) {
+        uint32_t key[4] = {i, 0, i, 0};  // binary keys with embedded zeros
+        errors += counting_bloom_add_bytes(&cb, key, sizeof(key)) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        if (i % 2 == 0)
+            errors += counting_bloom_add_bytes(&cb, key, sizeof(key)) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(4500, cb.elements_added);
+
+    for (uint32_t i = 0; i < 3000; ++i) {
+        uint32_t key[4] = {i, 0, i, 0};
+        errors += counting_bloom_check_bytes(&cb, key, sizeof(key)) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        errors += counting_bloom_get_max_insertions_bytes(&cb, key, sizeof(key)) == (i % 2 == 0 ? 2 : 1) ? 0 : 1;
+        errors += counting_bloom_remove_bytes(&cb, key, sizeof(key)) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(1500, cb.elements_added);
+
+    // the string and bytes functions agree on the same key
+    counting_bloom_add_string(&cb, "google");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_bytes(&cb, "google", 6));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_bytes(&cb, "google", 5));
+}
+
+MU_TEST(test_bloom_u64) {
+    int errors = 0;
+    for (uint64_t i = 0; i < 3000; ++i) {
+        uint64_t key = i * 0x100000001ULL;
+        errors += counting_bloom_add_u64(&cb, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        if (i % 2 == 0)
+            errors += counting_bloom_add_u64(&cb, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(4500, cb.elements_added);
+
+    for (uint64_t i = 0; i < 3000; ++i) {
+        uint64_t key = i * 0x100000001ULL;
+        errors += counting_bloom_check_u64(&cb, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        errors += counting_bloom_get_max_insertions_u64(&cb, key) == (i % 2 == 0 ? 2 : 1) ? 0 : 1;
+        errors += counting_bloom_remove_u64(&cb, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(1500, cb.elements_added);
+
+    /* check things that are not present */
+    for (uint64_t i = 3000; i < 5000; ++i) {
+        errors += counting_bloom_check_u64(&cb, i * 0x100000001ULL) == COUNTING_BLOOM_FAILURE ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+
+    uint64_t hashes[7];
+    counting_bloom_calculate_hashes_u64_into(12345, 7, hashes);
+    counting_bloom_add_string_alt(&cb, hashes, 7);
+    mu_assert_int_eq(1, counting_bloom_get_max_insertions_u64(&cb, 12345));
+}
+
+MU_TEST(test_bloom_add_batch) {
+    char filepath[] = "./dist/test_bloom_add_batch.blm";
+    char data[1000][10];
+    const char* keys[1000];
+    size_t lens[1000];
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(data[i], "%d", i % 700);  // some keys are repeated
+        keys[i] = data[i];
+        lens[i] = strlen(data[i]) + 1;  // include the NULL so bytes and string keys differ
+    }
+
+    CountingBloom expected, bf;
+    counting_bloom_init(&expected, 50000, 0.01);
+    counting_bloom_init_on_disk(&bf, 50000, 0.01, filepath);
+    for (int i = 0; i < 1000; ++i) {
+        counting_bloom_add_string(&expected, keys[i]);
+        counting_bloom_add_bytes(&expected, keys[i], lens[i]);
+    }
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_batch(&bf, keys, NULL, 1000));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_batch(&bf, keys, lens, 3));  // smaller than the window
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_batch(&bf, keys + 3, lens + 3, 997));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_add_batch(&bf, keys, lens, 0));
+    mu_assert_int_eq(2000, bf.elements_added);
+    mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, bf.number_bits * sizeof(uint32_t)));
+    counting_bloom_destroy(&bf);
+    counting_bloom_destroy(&expected);
+
+    counting_bloom_import(&bf, filepath);
+    mu_assert_int_eq(2000, bf.elements_added);  // header was updated
+    mu_assert_int_eq(2, counting_bloom_get_max_insertions(&bf, "1"));
+    mu_assert_int_eq(1, counting_bloom_get_max_insertions(&bf, "699"));
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_check_batch) {
+    char data[1000][10];
+    const char* keys[1000];
+    size_t lens[1000];
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(data[i], "%d", i);
+        keys[i] = data[i];
+        lens[i] = strlen(data[i]);
+    }
+    for (int i = 0; i < 500; ++i) {
+        counting_bloom_add_string(&cb, keys[i]);
+        if (i % 3 == 0)
+            counting_bloom_add_string(&cb, keys[i]);
+    }
+
+    uint8_t present[125];
+    uint32_t counts[1000];
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_batch(&cb, keys, NULL, 1000, present));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_get_max_insertions_batch(&cb, keys, lens, 1000, counts));
+    int errors = 0;
+    for (int i = 0; i < 1000; ++i) {
+        int expected = counting_bloom_check_string(&cb, keys[i]) == COUNTING_BLOOM_SUCCESS ? 1 : 0;
+        errors += ((present[i / 8] >> (i % 8)) & 1) == expected ? 0 : 1;
+        errors += counts[i] == (uint32_t)counting_bloom_get_max_insertions(&cb, keys[i]) ? 0 : 1;
+        if (i < 500)
+            errors += counts[i] == (i % 3 == 0 ? 2u : 1u) ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(0xFF, present[0]);
+    mu_assert_int_eq(0x00, present[124]);
+
+    // bits past n are left clear
+    memset(present, 0xFF, sizeof(present));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_batch(&cb, keys + 495, NULL, 10, present));
+    mu_assert_int_eq(0x1F, present[0]);
+    mu_assert_int_eq(0x00, present[1]);
+}
+
+MU_TEST(test_bloom_remove_batch) {
+    char filepath[] = "./dist/test_bloom_remove_batch.blm";
+    char data[1000][10];
+    const char* keys[1000];
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(data[i], "%d", i);
+        keys[i] = data[i];
+    }
+    CountingBloom bf;
+    counting_bloom_init_on_disk(&bf, 50000, 0.01, filepath);
+    counting_bloom_add_batch(&bf, keys, NULL, 600);
+    counting_bloom_add_batch(&bf, keys, NULL, 100);  // 0 - 99 are in twice
+
+    // 0 - 99 are repeated in the batch; 600 - 999 were never added
+    const char* removes[1100];
+    for (int i = 0; i < 1000; ++i)
+        removes[i] = keys[i];
+    for (int i = 0; i < 100; ++i)
+        removes[1000 + i] = keys[i];
+    uint8_t removed[138];
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_batch(&bf, removes, NULL, 1100, removed));
+    int errors = 0;
+    for (int i = 0; i < 1100; ++i) {
+        int expected = (i < 600 || i >= 1000) ? 1 : 0;
+        errors += ((removed[i / 8] >> (i % 8)) & 1) == expected ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(0, bf.elements_added);
+    mu_assert_int_eq(0, counting_bloom_count_set_bits(&bf));
+
+    // a second removal fails for every key
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_batch(&bf, removes, NULL, 100, removed));
+    for (int i = 0; i < 13; ++i)
+        errors += removed[i] == 0 ? 0 : 1;
+    mu_assert_int_eq(0, errors);
+    counting_bloom_destroy(&bf);
+
+    counting_bloom_import(&bf, filepath);
+    mu_assert_int_eq(0, bf.elements_added);  // header was updated
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_check_and_add) {
+    mu_assert_int_eq(COUNTING_BLOOM_ADDED, counting_bloom_check_and_add(&cb, "google"));
+    mu_assert_int_eq(COUNTING_BLOOM_PRESENT, counting_bloom_check_and_add(&cb, "google"));
+    mu_assert_int_eq(1, counting_bloom_get_max_insertions(&cb, "google"));  // not added a second time
+    mu_assert_int_eq(COUNTING_BLOOM_ADDED, counting_bloom_check_and_add_bytes(&cb, "google", 7));
+    mu_assert_int_eq(COUNTING_BLOOM_PRESENT, counting_bloom_check_and_add_bytes(&cb, "google", 7));
+    mu_assert_int_eq(2, cb.elements_added);
+
+    // errors are not reported as added and add nothing
+    uint64_t hashes[1] = {0};
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_and_add_alt(&cb, hashes, 1));
+    mu_assert_int_eq(2, cb.elements_added);
+
+    char data[1000][10];
+    const char* keys[1100];
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(data[i], "%d", i);
+        keys[i] = data[i];
+    }
+    for (int i = 0; i < 100; ++i)
+        keys[1000 + i] = data[i * 3];
+    counting_bloom_add_batch(&cb, keys, NULL, 500);
+
+    uint8_t present[138];
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_and_add_batch(&cb, keys, NULL, 1100, present));
+    int errors = 0;
+    for (int i = 0; i < 1100; ++i) {
+        int expected = (i < 500 || i >= 1000) ? 1 : 0;
+        errors += ((present[i / 8] >> (i % 8)) & 1) == expected ? 0 : 1;
+        errors += counting_bloom_get_max_insertions(&cb, keys[i]) == 1 ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(1002, cb.elements_added);
+}
+
+MU_TEST(test_bloom_index_modes) {
+    CountingBloomIndexMode modes[] = {COUNTING_BLOOM_INDEX_FASTRANGE, COUNTING_BLOOM_INDEX_POWER_OF_TWO};
+    uint64_t bits[] = {479253, 524288};
+    for (int m = 0; m < 2; ++m) {
+        CountingBloom bf;
+        CountingBloomOptions opts;
+        counting_bloom_options_init(&opts);
+        opts.index_mode = modes[m];
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+        mu_assert_int_eq(bits[m], bf.number_bits);
+        mu_assert_int_eq(7, bf.number_hashes);
+
+        int errors = 0;
+        for (int i = 0; i < 50000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_add_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        for (int i = 0; i < 50000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        mu_assert_int_eq(0, errors);
+
+        /* check things that are not present */
+        for (int i = 50000; i < 60000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_FAILURE ? 0 : 1;
+        }
+        mu_assert_int_between(0, 200, errors);  // around 1% false positives
+        // keys that cluster can pass the check above while setting far fewer counters
+        mu_assert(counting_bloom_count_set_bits(&bf) > 50000 * 7 / 2, "index mode keys cluster");
+        counting_bloom_destroy(&bf);
+    }
+}
+
+MU_TEST(test_bloom_counter_widths) {
+    unsigned int widths[] = {4, 8, 16};
+    for (int w = 0; w < 3; ++w) {
+        CountingBloom bf;
+        CountingBloomOptions opts;
+        counting_bloom_options_init(&opts);
+        opts.counter_width = widths[w];
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+        mu_assert_int_eq(widths[w], bf.counter_width);
+        mu_assert_int_eq(479253, bf.number_bits);
+
+        int errors = 0;
+        for (int i = 0; i < 3000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_add_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+            if (i % 2 == 0)
+                errors += counting_bloom_add_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        for (int i = 0; i < 3000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_get_max_insertions(&bf, key) == (i % 2 == 0 ? 2 : 1) ? 0 : 1;
+            errors += counting_bloom_remove_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+            errors += counting_bloom_get_max_insertions(&bf, key) == (i % 2 == 0 ? 1 : 0) ? 0 : 1;
+        }
+        mu_assert_int_eq(0, errors);
+        mu_assert_int_eq(1500, bf.elements_added);
+        counting_bloom_destroy(&bf);
+    }
+
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 12;
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_init_opts(&bf, 50000, 0.01, &opts));
+}
+
+MU_TEST(test_bloom_counter_width_saturation) {
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 4;
+    counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+    for (int i = 0; i < 20; ++i)
+        counting_bloom_add_string(&bf, "google");
+    counting_bloom_add_string(&bf, "facebook");
+    mu_assert_int_eq(15, counting_bloom_get_max_insertions(&bf, "google"));
+    mu_assert_int_eq(1, counting_bloom_get_max_insertions(&bf, "facebook"));
+
+    // saturated counters are sticky
+    for (int i = 0; i < 3; ++i)
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_string(&bf, "google"));
+    mu_assert_int_eq(15, counting_bloom_get_max_insertions(&bf, "google"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_string(&bf, "facebook"));
+    mu_assert_int_eq(0, counting_bloom_get_max_insertions(&bf, "facebook"));
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_merge) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    for (unsigned int width = 4; width <= 32; width *= 2) {
+        CountingBloom a, b, expected;
+        opts.counter_width = width;
+        counting_bloom_init_opts(&a, 5000, 0.01, &opts);
+        counting_bloom_init_opts(&b, 5000, 0.01, &opts);
+        counting_bloom_init_opts(&expected, 5000, 0.01, &opts);
+        for (int i = 0; i < 2000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            counting_bloom_add_string((i < 1000) ? &a : &b, key);
+            counting_bloom_add_string(&expected, key);
+        }
+        for (int i = 0; i < 10; ++i) {
+            counting_bloom_add_string(&a, "google");
+            counting_bloom_add_string(&b, "google");
+            counting_bloom_add_string(&expected, "google");
+            counting_bloom_add_string(&expected, "google");
+        }
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_merge(&a, &b));
+        mu_assert_int_eq(expected.elements_added, a.elements_added);
+        mu_assert_int_eq(0, memcmp(expected.bloom, a.bloom, (a.number_bits * width + 7) / 8));
+        mu_assert_int_eq((width == 4) ? 15 : 20, counting_bloom_get_max_insertions(&a, "google"));
+        counting_bloom_destroy(&a);
+        counting_bloom_destroy(&b);
+        counting_bloom_destroy(&expected);
+    }
+
+    // 32 bit counters saturate in the vector loop and in the remainder
+    CountingBloom a, b;
+    counting_bloom_init(&a, 1001, 0.01);
+    counting_bloom_init(&b, 1001, 0.01);
+    uint64_t last = a.number_bits - 1;
+    a.bloom[0] = a.bloom[last] = UINT32_MAX - 1;
+    b.bloom[0] = b.bloom[last] = 5;
+    b.bloom[1] = 7;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_merge(&a, &b));
+    mu_assert(a.bloom[0] == UINT32_MAX && a.bloom[last] == UINT32_MAX, "Expected merged counters to saturate");
+    mu_assert_int_eq(7, a.bloom[1]);
+    counting_bloom_destroy(&b);
+
+    // different parameters can not be merged
+    counting_bloom_init(&b, 1001, 0.05);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_merge(&a, &b));
+    counting_bloom_destroy(&b);
+    counting_bloom_destroy(&a);
+}
+
+MU_TEST(test_bloom_bulk_build) {
+    const char* files[] = {"./dist/test_bulk_1.txt", "./dist/test_bulk_2.txt"};
+    CountingBloom bf, expected;
+    counting_bloom_init(&expected, 40000, 0.01);
+
+    // a file large enough to be split between the threads, with windows line endings and empty lines
+    FILE* fp = fopen(files[0], "wb");
+    for (int i = 0; i < 30000; ++i) {
+        char key[16] = {0};
+        sprintf(key, "key-%d", i);
+        fprintf(fp, (i % 7 == 0) ? "%s\r\n" : (i % 11 == 0) ? "%s\n\n" : "%s\n", key);
+        counting_bloom_add_string(&expected, key);
+    }
+    fclose(fp);
+    // a small file without a final newline
+    fp = fopen(files[1], "wb");
+    for (int i = 0; i < 100; ++i) {
+        fprintf(fp, (i == 99) ? "%d" : "%d\n", i);
+        char key[16] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&expected, key);
+    }
+    fclose(fp);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_bulk_build(&bf, 40000, 0.01, NULL, files, 2, 4));
+    mu_assert_int_eq(expected.number_bits, bf.number_bits);
+    mu_assert_int_eq(30100, bf.elements_added);
+    mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, bf.number_bits * sizeof(uint32_t)));
+    counting_bloom_destroy(&bf);
+
+    // a single thread gives the same counting bloom
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_bulk_build(&bf, 40000, 0.01, NULL, files, 2, 1));
+    mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, bf.number_bits * sizeof(uint32_t)));
+    counting_bloom_destroy(&bf);
+
+    const char* missing[] = {"./dist/test_bulk_missing.txt"};
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_bulk_build(&bf, 40000, 0.01, NULL, missing, 1, 4));
+    counting_bloom_destroy(&expected);
+    remove(files[0]);
+    remove(files[1]);
+}
+
+MU_TEST(test_bloom_pipeline_add) {
+    const uint64_t n = 70000;  // more than one round
+    char* data = (char*)calloc(n, 16);
+    const char** keys = (const char**)calloc(n, sizeof(char*));
+    size_t* lens = (size_t*)calloc(n, sizeof(size_t));
+    for (uint64_t i = 0; i < n; ++i) {
+        sprintf(&data[i * 16], "%" PRIu64, i % 50000);
+        keys[i] = &data[i * 16];
+        lens[i] = strlen(keys[i]);
+    }
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    for (unsigned int width = 4; width <= 32; width *= 8) {
+        CountingBloom bf, expected;
+        opts.counter_width = width;
+        counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+        counting_bloom_init_opts(&expected, 50000, 0.01, &opts);
+        counting_bloom_add_batch(&expected, keys, NULL, n);
+
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_pipeline_add(&bf, keys, NULL, n, 3, 5));
+        mu_assert_int_eq(n, bf.elements_added);
+        mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, (bf.number_bits * width + 7) / 8));
+
+        // byte keys, a single thread per stage
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_pipeline_add(&bf, keys, lens, n, 1, 1));
+        counting_bloom_add_batch(&expected, keys, lens, n);
+        mu_assert_int_eq(2 * n, bf.elements_added);
+        mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, (bf.number_bits * width + 7) / 8));
+        mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_pipeline_add(&bf, keys, NULL, n, 0, 1));
+        counting_bloom_destroy(&bf);
+        counting_bloom_destroy(&expected);
+    }
+    free(lens);
+    free(keys);
+    free(data);
+}
+
+MU_TEST(test_bloom_blocked_layout) {
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.layout = COUNTING_BLOOM_LAYOUT_BLOCKED;
+    for (int width = 8; width <= 32; width *= 2) {
+        opts.counter_width = width;
+        counting_bloom_init_opts(&bf, 10000, 0.01, &opts);
+        mu_assert_int_eq(64, bf.block_size);
+        mu_assert_int_eq(512 / width, bf.__block_counters);
+        mu_assert_int_eq(0, bf.number_bits % bf.__block_counters);
+        mu_assert(bf.number_bits > 95851, "blocked layout needs more counters");  // 95851 is the standard size
+        mu_assert_int_eq(0, ((uintptr_t)bf.bloom) % 64);
+
+        for (int i = 0; i < 10000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            counting_bloom_add_string(&bf, key);
+        }
+        int errors = 0, false_positives = 0;
+        for (int i = 0; i < 10000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+            sprintf(key, "x%d", i);
+            false_positives += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 1 : 0;
+        }
+        mu_assert_int_eq(0, errors);
+        mu_assert(false_positives < 150, "blocked layout false positive rate too high");
+        counting_bloom_destroy(&bf);
+    }
+
+    // the block is picked well for every index mode with the default (FNV-1a) hash;
+    // keys that cluster into few blocks set far fewer counters than keys * hashes
+    CountingBloomLayout layouts[] = {COUNTING_BLOOM_LAYOUT_BLOCKED, COUNTING_BLOOM_LAYOUT_PAGE_BLOCKED};
+    CountingBloomIndexMode modes[] = {COUNTING_BLOOM_INDEX_MODULO, COUNTING_BLOOM_INDEX_FASTRANGE, COUNTING_BLOOM_INDEX_POWER_OF_TWO};
+    opts.counter_width = 0;
+    for (int l = 0; l < 2; ++l) {
+        for (int m = 0; m < 3; ++m) {
+            opts.layout = layouts[l];
+            opts.index_mode = modes[m];
+            counting_bloom_init_opts(&bf, 10000, 0.01, &opts);
+            for (int i = 0; i < 10000; ++i) {
+                char key[10] = {0};
+                sprintf(key, "%d", i);
+                counting_bloom_add_string(&bf, key);
+            }
+            int false_positives = 0;
+            for (int i = 0; i < 10000; ++i) {
+                char key[10] = {0};
+                sprintf(key, "x%d", i);
+                false_positives += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 1 : 0;
+            }
+            mu_assert(false_positives < 150, "blocked layout false positive rate too high");
+            mu_assert(counting_bloom_count_set_bits(&bf) > 10000 * bf.number_hashes / 2, "blocked layout keys cluster");
+            counting_bloom_destroy(&bf);
+        }
+    }
+    opts.layout = COUNTING_BLOOM_LAYOUT_BLOCKED;
+
+    // the block count follows the index mode
+    opts.index_mode = COUNTING_BLOOM_INDEX_POWER_OF_TWO;
+    counting_bloom_init_opts(&bf, 10000, 0.01, &opts);
+    mu_assert_int_eq(0, bf.__number_blocks & (bf.__number_blocks - 1));
+    counting_bloom_add_string(&bf, "google");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&bf, "google"));
+    counting_bloom_destroy(&bf);
+}
+
+MU_TEST(test_bloom_probe) {
+    CountingBloomProbe probes[] = {COUNTING_BLOOM_PROBE_AUTO, COUNTING_BLOOM_PROBE_AVX2, COUNTING_BLOOM_PROBE_AVX512};
+    float rates[] = {0.5, 0.1, 0.01, 0.001, 0.0001, 0.000001, 0.00000001};  // 1 to 27 hashes
+    for (int r = 0; r < 7; ++r) {
+        CountingBloom expected;
+        counting_bloom_init(&expected, 2000, rates[r]);
+        for (int i = 0; i < 1000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            for (int j = 0; j <= i % 3; ++j)
+                counting_bloom_add_string(&expected, key);
+        }
+        for (int p = 0; p < 3; ++p) {
+            CountingBloom bf;
+            CountingBloomOptions opts;
+            counting_bloom_options_init(&opts);
+            opts.probe = probes[p];
+            counting_bloom_init_opts(&bf, 2000, rates[r], &opts);
+            memcpy(bf.bloom, expected.bloom, bf.number_bits * sizeof(uint32_t));
+            int errors = 0;
+            for (int i = 0; i < 3000; ++i) {  // a third are not present
+                char key[10] = {0};
+                sprintf(key, "%d", i);
+                errors += counting_bloom_check_string(&bf, key) == counting_bloom_check_string(&expected, key) ? 0 : 1;
+                errors += counting_bloom_get_max_insertions(&bf, key) == counting_bloom_get_max_insertions(&expected, key) ? 0 : 1;
+            }
+            mu_assert_int_eq(0, errors);
+            counting_bloom_destroy(&bf);
+        }
+        counting_bloom_destroy(&expected);
+    }
+}
+
+MU_TEST(test_bloom_concurrent) {
+    unsigned int widths[] = {4, 32};
+    for (int w = 0; w < 2; ++w) {
+        CountingBloom bf, expected;
+        CountingBloomOptions opts;
+        counting_bloom_options_init(&opts);
+        opts.counter_width = widths[w];
+        counting_bloom_init_opts(&expected, 2 * STRESS_KEYS, 0.01, &opts);
+        opts.concurrent = 1;
+        counting_bloom_init_opts(&bf, 2 * STRESS_KEYS, 0.01, &opts);
+        mu_assert_int_eq(1, bf.concurrent);
+
+        // every thread adds the shared keys and a range of its own
+        for (int t = 0; t < STRESS_THREADS; ++t) {
+            for (int i = 0; i < STRESS_KEYS; ++i) {
+                char key[16] = {0};
+                sprintf(key, "%d", i);
+                counting_bloom_add_string(&expected, key);
+                sprintf(key, "t%d-%d", t, i % 100);
+                counting_bloom_add_string(&expected, key);
+            }
+        }
+        pthread_t threads[STRESS_THREADS];
+        StressArgs args[STRESS_THREADS];
+        for (int t = 0; t < STRESS_THREADS; ++t) {
+            args[t].bf = &bf;
+            args[t].thread = t;
+            args[t].errors = 0;
+            pthread_create(&threads[t], NULL, concurrent_add, &args[t]);
+        }
+        for (int t = 0; t < STRESS_THREADS; ++t)
+            pthread_join(threads[t], NULL);
+        mu_assert_int_eq(2 * STRESS_THREADS * STRESS_KEYS, bf.elements_added);
+        mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, (bf.number_bits * bf.counter_width + 7) / 8));
+
+        // every thread removes the shared keys once; all must succeed
+        for (int t = 0; t < STRESS_THREADS; ++t) {
+            for (int i = 0; i < STRESS_KEYS; ++i) {
+                char key[16] = {0};
+                sprintf(key, "%d", i);
+                counting_bloom_remove_string(&expected, key);
+            }
+        }
+        for (int t = 0; t < STRESS_THREADS; ++t)
+            pthread_create(&threads[t], NULL, concurrent_remove, &args[t]);
+        for (int t = 0; t < STRESS_THREADS; ++t) {
+            pthread_join(threads[t], NULL);
+            mu_assert_int_eq(0, args[t].errors);
+        }
+        mu_assert_int_eq(STRESS_THREADS * STRESS_KEYS, bf.elements_added);
+        mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, (bf.number_bits * bf.counter_width + 7) / 8));
+        counting_bloom_destroy(&bf);
+        counting_bloom_destroy(&expected);
+    }
+}
+
+MU_TEST(test_bloom_deltas) {
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    for (unsigned int width = 4; width <= 32; width *= 8) {
+        // a small buffer flushes itself part way; a large one only on destroy
+        uint64_t capacities[] = {32, 100000};
+        for (int c = 0; c < 2; ++c) {
+            CountingBloom bf, expected;
+            CountingBloomDeltas deltas;
+            opts.counter_width = width;
+            counting_bloom_init_opts(&bf, 5000, 0.01, &opts);
+            counting_bloom_init_opts(&expected, 5000, 0.01, &opts);
+            mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_deltas_init(&deltas, &bf, capacities[c]));
+            for (int i = 0; i < 2000; ++i) {
+                char key[16] = {0};
+                sprintf(key, "%d", i);
+                counting_bloom_deltas_add_string(&deltas, key);
+                counting_bloom_add_string(&expected, key);
+                if (i % 3 == 0) {
+                    mu_assert_int_eq(counting_bloom_remove_string(&expected, key), counting_bloom_deltas_remove_bytes(&deltas, key, strlen(key)));
+                }
+                // hot keys saturate 4 bit counters and the removes must not undo that
+                counting_bloom_deltas_add_bytes(&deltas, "google", 6);
+                counting_bloom_add_string(&expected, "google");
+                if (i % 4 == 0) {
+                    mu_assert_int_eq(counting_bloom_remove_string(&expected, "google"), counting_bloom_deltas_remove_string(&deltas, "google"));
+                }
+            }
+            mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_deltas_remove_string(&deltas, "not-added"));
+            counting_bloom_deltas_destroy(&deltas);
+            mu_assert(deltas.slots == NULL, "Expected the delta buffer to be released");
+            mu_assert_int_eq(expected.elements_added, bf.elements_added);
+            mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, (bf.number_bits * width + 7) / 8));
+            counting_bloom_destroy(&bf);
+            counting_bloom_destroy(&expected);
+        }
+    }
+
+    // capacities the slot count can not be rounded up to are rejected
+    CountingBloom bf, expected;
+    CountingBloomDeltas deltas;
+    counting_bloom_init(&bf, 5000, 0.01);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_deltas_init(&deltas, &bf, COUNTING_BLOOM_MAX_DELTAS + 1));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_deltas_init(&deltas, &bf, UINT64_MAX));
+    counting_bloom_destroy(&bf);
+
+    // several threads flush into a concurrent counting bloom
+    counting_bloom_init(&expected, 2 * STRESS_KEYS, 0.01);
+    opts.counter_width = 32;
+    opts.concurrent = 1;
+    counting_bloom_init_opts(&bf, 2 * STRESS_KEYS, 0.01, &opts);
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        for (int i = 0; i < STRESS_KEYS; ++i) {
+            char key[16] = {0};
+            sprintf(key, "hot-%d", i % 10);
+            counting_bloom_add_string(&expected, key);
+            sprintf(key, "t%d-%d", t, i);
+            counting_bloom_add_string(&expected, key);
+        }
+    }
+    pthread_t threads[STRESS_THREADS];
+    StressArgs args[STRESS_THREADS];
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        args[t].bf = &bf;
+        args[t].thread = t;
+        args[t].errors = 0;
+        pthread_create(&threads[t], NULL, deltas_add, &args[t]);
+    }
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+        mu_assert_int_eq(0, args[t].errors);
+    }
+    mu_assert_int_eq(2 * STRESS_THREADS * STRESS_KEYS, bf.elements_added);
+    mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, bf.number_bits * sizeof(uint32_t)));
+    counting_bloom_destroy(&bf);
+    counting_bloom_destroy(&expected);
+}
+
+MU_TEST(test_bloom_shared) {
+    char name[64] = {0};
+    sprintf(name, "/cbm-test-%d", (int)getpid());
+    CountingBloom bf, expected;
+    counting_bloom_init(&expected, 2 * STRESS_KEYS, 0.01);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_shared(&bf, 2 * STRESS_KEYS, 0.01, name));
+    mu_assert_int_eq(1, bf.concurrent);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_init_shared(&expected, 2 * STRESS_KEYS, 0.01, name));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_attach_shared(&expected, "/cbm-test-not-created"));
+
+    // a child process attaches and adds keys while this one adds others
+    pid_t pid = fork();
+    if (pid == 0) {
+        CountingBloom child;
+        if (counting_bloom_attach_shared(&child, name) == COUNTING_BLOOM_FAILURE) {
+            _exit(1);
+        }
+        for (int i = 0; i < STRESS_KEYS; ++i) {
+            char key[16] = {0};
+            sprintf(key, "c%d", i);
+            counting_bloom_add_string(&child, key);
+        }
+        counting_bloom_destroy(&child);
+        _exit(0);
+    }
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        char key[16] = {0};
+        sprintf(key, "p%d", i);
+        counting_bloom_add_string(&bf, key);
+        counting_bloom_add_string(&expected, key);
+        sprintf(key, "c%d", i);
+        counting_bloom_add_string(&expected, key);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    mu_assert_int_eq(0, status);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&bf, "c100"));
+    mu_assert_int_eq(0, memcmp(expected.bloom, bf.bloom, expected.number_bits * sizeof(uint32_t)));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_remove_string(&bf, "c100"));
+    mu_assert_int_eq(2 * STRESS_KEYS - 1, bf.elements_added);
+
+    // attaching again sees the same counting bloom
+    CountingBloom other;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_attach_shared(&other, name));
+    mu_assert_int_eq(bf.number_bits, other.number_bits);
+    mu_assert_int_eq(bf.number_hashes, other.number_hashes);
+    mu_assert_int_eq(2 * STRESS_KEYS - 1, other.elements_added);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&other, "p100"));
+    counting_bloom_destroy(&other);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_unlink_shared(name));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_attach_shared(&other, name));
+    counting_bloom_destroy(&bf);
+    counting_bloom_destroy(&expected);
+}
+
+MU_TEST(test_bloom_replica) {
+    char filepath[] = "./dist/test_bloom_replica.blm";
+    CountingBloom master, replica, reader;
+    counting_bloom_init(&master, 10000, 0.01);
+    counting_bloom_add_string(&master, "google");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_replica(&replica, &master, filepath));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_open_replica(&reader, filepath));
+    mu_assert_int_eq(master.number_bits, reader.number_bits);
+    mu_assert_int_eq(1, reader.elements_added);
+    uint64_t seq = counting_bloom_replica_read_begin(&reader);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&reader, "google"));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(&reader, "facebook"));
+    mu_assert_int_eq(0, counting_bloom_replica_read_retry(&reader, seq));
+
+    // changes show up once published and the read started before then must retry
+    counting_bloom_add_string(&master, "facebook");
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(&reader, "facebook"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_replica_publish(&replica, &master));
+    mu_assert_int_eq(1, counting_bloom_replica_read_retry(&reader, seq));
+    seq = counting_bloom_replica_read_begin(&reader);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&reader, "facebook"));
+    mu_assert_int_eq(0, counting_bloom_replica_read_retry(&reader, seq));
+
+    CountingBloom other;
+    counting_bloom_init(&other, 20000, 0.01);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_replica_publish(&replica, &other));
+    counting_bloom_destroy(&other);
+
+    // a child process keeps publishing two keys added the same number of times;
+    // every read that does not need a retry must see them equal
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int i = 0; i < 2000; ++i) {
+            counting_bloom_add_string(&master, "hot-1");
+            counting_bloom_add_string(&master, "hot-2");
+            counting_bloom_replica_publish(&replica, &master);
+        }
+        _exit(0);
+    }
+    int errors = 0;
+    for (int i = 0; i < 20000; ++i) {
+        int first, second;
+        do {
+            seq = counting_bloom_replica_read_begin(&reader);
+            first = counting_bloom_get_max_insertions(&reader, "hot-1");
+            second = counting_bloom_get_max_insertions(&reader, "hot-2");
+        } while (counting_bloom_replica_read_retry(&reader, seq));
+        errors += (first != second) ? 1 : 0;
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    mu_assert_int_eq(0, status);
+    mu_assert_int_eq(0, errors);
+    mu_assert_int_eq(2000, counting_bloom_get_max_insertions(&reader, "hot-1"));
+
+    counting_bloom_destroy(&reader);
+    counting_bloom_destroy(&replica);
+    counting_bloom_destroy(&master);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_open_replica(&reader, "./dist/test_bloom_not_a_replica.blm"));
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_replica_replace) {
+    char filepath[] = "./dist/test_bloom_replica_replace.blm";
+    CountingBloom master, replica, reader;
+    counting_bloom_init(&master, 100000, 0.01);
+    counting_bloom_add_string(&master, "google");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_replica(&replica, &master, filepath));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_open_replica(&reader, filepath));
+    counting_bloom_destroy(&replica);
+    counting_bloom_destroy(&master);
+
+    // a smaller replica replaces the file; the reader keeps the one it mapped
+    CountingBloom other_master, other_replica, other_reader;
+    counting_bloom_init(&other_master, 1000, 0.01);
+    counting_bloom_add_string(&other_master, "facebook");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_replica(&other_replica, &other_master, filepath));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&reader, "google"));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(&reader, "facebook"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_open_replica(&other_reader, filepath));
+    mu_assert_int_eq(other_master.number_bits, other_reader.number_bits);
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&other_reader, "facebook"));
+
+    // a counting bloom that is not mapped never needs a retry
+    uint64_t seq = counting_bloom_replica_read_begin(&other_master);
+    mu_assert_int_eq(0, counting_bloom_replica_read_retry(&other_master, seq));
+
+    counting_bloom_destroy(&other_reader);
+    counting_bloom_destroy(&other_replica);
+    counting_bloom_destroy(&other_master);
+    counting_bloom_destroy(&reader);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_open_replica_invalid_header) {
+    char filepath[] = "./dist/test_bloom_open_replica_invalid_header.blm";
+    CountingBloom master, replica, reader;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 8;
+    opts.layout = COUNTING_BLOOM_LAYOUT_BLOCKED;
+    counting_bloom_init_opts(&master, 50000, 0.01, &opts);
+
+    // header: magic, ready, sequence, estimated elements, number bits, elements added, fpr, then the fields
+    // (hashes, hash mode, index mode, hash type, counter width, block size)
+    long fields_offset = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 4 + sizeof(float);
+    uint32_t fields[][2] = {{0, 0}, {0, 1000}, {1, 9}, {2, 9}, {3, 9}, {4, 7}, {4, 64}, {5, 16}, {5, 96}};
+    for (int f = -1; f < 9; ++f) {
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_replica(&replica, &master, filepath));
+        counting_bloom_destroy(&replica);
+        FILE* fp = fopen(filepath, "r+b");
+        if (f == -1) {  // no elements expected
+            uint64_t estimated_elements = 0;
+            fseek(fp, sizeof(uint32_t) * 2 + sizeof(uint64_t), SEEK_SET);
+            fwrite(&estimated_elements, sizeof(uint64_t), 1, fp);
+        } else {
+            fseek(fp, fields_offset + fields[f][0] * sizeof(uint32_t), SEEK_SET);
+            fwrite(&fields[f][1], sizeof(uint32_t), 1, fp);
+        }
+        fclose(fp);
+        mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_open_replica(&reader, filepath));
+    }
+    counting_bloom_destroy(&master);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_sharded_false_positive_rate) {
+    // the shard must not be picked from hash bits the shards use for their own indices;
+    // wyhash since the high bits of FNV-1a for short keys are too weak for fastrange
+    CountingBloomIndexMode modes[] = {COUNTING_BLOOM_INDEX_MODULO, COUNTING_BLOOM_INDEX_FASTRANGE, COUNTING_BLOOM_INDEX_POWER_OF_TWO};
+    CountingBloomLayout layouts[] = {COUNTING_BLOOM_LAYOUT_STANDARD, COUNTING_BLOOM_LAYOUT_BLOCKED};
+    for (int m = 0; m < 3; ++m) {
+        for (int l = 0; l < 2; ++l) {
+            CountingBloomSharded cbs;
+            CountingBloomOptions opts;
+            counting_bloom_options_init(&opts);
+            opts.index_mode = modes[m];
+            opts.layout = layouts[l];
+            opts.hash_type = COUNTING_BLOOM_HASH_TYPE_WYHASH;
+            counting_bloom_sharded_init(&cbs, 8, 80000, 0.01, &opts);
+            for (int i = 0; i < 80000; ++i) {
+                char key[16] = {0};
+                sprintf(key, "%d", i);
+                counting_bloom_sharded_add_string(&cbs, key);
+            }
+            int false_positives = 0;
+            for (int i = 0; i < 100000; ++i) {
+                char key[16] = {0};
+                sprintf(key, "fp-%d", i);
+                false_positives += counting_bloom_sharded_check_string(&cbs, key) == COUNTING_BLOOM_SUCCESS ? 1 : 0;
+            }
+            mu_assert(false_positives < 1250, "sharded false positive rate too high");  // 1% target, about 1000
+            counting_bloom_sharded_destroy(&cbs);
+        }
+    }
+}
+
+MU_TEST(test_bloom_sharded) {
+    CountingBloomSharded cbs;
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_sharded_init(&cbs, 0, 1000, 0.01, NULL));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_sharded_init(&cbs, COUNTING_BLOOM_MAX_SHARDS + 1, 100000, 0.01, NULL));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_sharded_init(&cbs, STRESS_THREADS, 2 * STRESS_THREADS * STRESS_KEYS, 0.01, NULL));
+    mu_assert_int_eq(STRESS_THREADS, cbs.number_shards);
+    mu_assert_int_eq(2 * STRESS_KEYS, cbs.shards[0].estimated_elements);
+
+    // each thread places its shard and then adds the shared keys and its own
+    pthread_t threads[STRESS_THREADS];
+    ShardedArgs args[STRESS_THREADS];
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        args[t].cbs = &cbs;
+        args[t].thread = t;
+        args[t].errors = 0;
+        pthread_create(&threads[t], NULL, sharded_add, &args[t]);
+    }
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+        mu_assert_int_eq(0, args[t].errors);
+    }
+    mu_assert_int_eq(2 * STRESS_THREADS * STRESS_KEYS, counting_bloom_sharded_elements_added(&cbs));
+
+    // every shard is used and each key is counted in its shard
+    for (unsigned int i = 0; i < cbs.number_shards; ++i)
+        mu_assert(cbs.shards[i].elements_added > 0, "Each shard should hold some keys");
+    mu_assert_int_eq(STRESS_THREADS, counting_bloom_sharded_get_max_insertions(&cbs, "10"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_sharded_check_bytes(&cbs, "t1-10", 5));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_sharded_check_string(&cbs, "not-added"));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_sharded_remove_string(&cbs, "10"));
+    mu_assert_int_eq(STRESS_THREADS - 1, counting_bloom_sharded_get_max_insertions_bytes(&cbs, "10", 2));
+
+    // export and import round trip through the manifest and shard files
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_sharded_export(&cbs, "./dist/test_sharded.cbm"));
+    CountingBloomSharded imported;
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_sharded_import(&imported, "./dist/test_sharded.cbm.0", NULL));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_sharded_import(&imported, "./dist/test_sharded.cbm", NULL));
+    mu_assert_int_eq(STRESS_THREADS, imported.number_shards);
+    mu_assert_int_eq(counting_bloom_sharded_elements_added(&cbs), counting_bloom_sharded_elements_added(&imported));
+    for (unsigned int i = 0; i < cbs.number_shards; ++i)
+        mu_assert_int_eq(0, memcmp(cbs.shards[i].bloom, imported.shards[i].bloom, cbs.shards[i].number_bits * sizeof(uint32_t)));
+    mu_assert_int_eq(STRESS_THREADS - 1, counting_bloom_sharded_get_max_insertions(&imported, "10"));
+    counting_bloom_sharded_destroy(&imported);
+
+    // a corrupt shard count is rejected before anything is allocated or opened
+    uint32_t number_shards = UINT32_MAX;
+    FILE* fp = fopen("./dist/test_sharded.cbm", "r+b");
+    fseek(fp, sizeof(uint32_t), SEEK_SET);
+    fwrite(&number_shards, sizeof(uint32_t), 1, fp);
+    fclose(fp);
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_sharded_import(&imported, "./dist/test_sharded.cbm", NULL));
+
+    counting_bloom_sharded_destroy(&cbs);
+    mu_assert_int_eq(0, cbs.number_shards);
+    mu_assert(cbs.shards == NULL, "Expected shards to be released");
+
+    remove("./dist/test_sharded.cbm");
+    char path[32];
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        sprintf(path, "./dist/test_sharded.cbm.%d", t);
+        remove(path);
+    }
+}
+
+MU_TEST(test_bloom_snapshots) {
+    CountingBloom bf;
+    CountingBloomSnapshots snaps;
+    counting_bloom_init(&bf, 2 * STRESS_KEYS, 0.01);
+    counting_bloom_add_string(&bf, "google");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_snapshots_init(&snaps, &bf, 2));
+    mu_assert_int_eq(1, snaps.generation);
+
+    // a held snapshot does not see later changes; a new one does
+    const CountingBloom* snap = counting_bloom_snapshots_acquire(&snaps, 0);
+    counting_bloom_add_string(&bf, "facebook");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_snapshots_publish(&snaps));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_snapshots_publish(&snaps));
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(snap, "google"));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(snap, "facebook"));
+    mu_assert_int_eq(1, snap->elements_added);
+    const CountingBloom* latest = counting_bloom_snapshots_acquire(&snaps, 1);
+    mu_assert(latest != snap, "Expected a new snapshot");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(latest, "facebook"));
+    mu_assert_int_eq(2, latest->elements_added);
+    mu_assert_int_eq(0, latest->__is_on_disk);
+
+    // with both readers holding an old snapshot every buffer is used and none is overwritten
+    counting_bloom_add_string(&bf, "twitter");
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_snapshots_publish(&snaps));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(snap, "twitter"));
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_check_string(latest, "twitter"));
+    counting_bloom_snapshots_release(&snaps, 0);
+    counting_bloom_snapshots_release(&snaps, 1);
+    counting_bloom_snapshots_destroy(&snaps);
+
+    // readers check that every key the writer added before a publish is in the snapshot
+    short done = 0;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_snapshots_init(&snaps, &bf, STRESS_THREADS));
+    pthread_t threads[STRESS_THREADS];
+    SnapshotArgs args[STRESS_THREADS];
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        args[t].snaps = &snaps;
+        args[t].reader = t;
+        args[t].done = &done;
+        args[t].errors = 0;
+        args[t].reads = 0;
+        pthread_create(&threads[t], NULL, snapshot_reader, &args[t]);
+    }
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        char key[16] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+        if (i % 10 == 0) {
+            counting_bloom_snapshots_publish(&snaps);
+        }
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    for (int t = 0; t < STRESS_THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+        mu_assert_int_eq(0, args[t].errors);
+    }
+    counting_bloom_snapshots_destroy(&snaps);
+    counting_bloom_destroy(&bf);
+}
+
 MU_TEST(test_bloom_set_failure) {
     uint64_t* hashes = counting_bloom_calculate_hashes(&cb, "three", 3); // we want too few!
     mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_add_string_alt(&cb, hashes, 3));
@@ -474,6 +1719,18 @@ MU_TEST(test_bloom_export_size) {  // size is in bytes
     counting_bloom_destroy(&bf);
 }
 
+MU_TEST(test_bloom_export_size_counter_width) {
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 4;
+    counting_bloom_init_opts(&bf, 100000, .001, &opts);
+    mu_assert_int_eq(718880 + 12 + 40, counting_bloom_export_size(&bf));  // half a byte per counter plus the extension
+    mu_assert_int_eq(718880, counting_bloom_counter_bytes(&bf));
+    mu_assert_int_eq(1437759, bf.number_bits);
+    counting_bloom_destroy(&bf);
+}
+
 // MU_TEST(test_bloom_estimate_elements) {
 //     for (int i = 0; i < 5000; ++i) {
 //         char key[10] = {0};
@@ -567,6 +1824,226 @@ MU_TEST(test_bloom_import) {
     remove(filepath);
 }
 
+MU_TEST(test_bloom_import_double_hashing) {
+    char filepath[] = "./dist/test_bloom_import_double_hashing.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_mode = COUNTING_BLOOM_HASH_DOUBLE;
+    counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_export(&bf, filepath));
+    mu_assert_int_eq(1917072, fsize(filepath));  // extension block follows the counters
+    counting_bloom_destroy(&bf);
+
+    // the hash mode comes from the file, not the passed hash function
+    for (int on_disk = 0; on_disk < 2; ++on_disk) {
+        if (on_disk == 0)
+            counting_bloom_import(&bf, filepath);
+        else
+            counting_bloom_import_on_disk(&bf, filepath);
+        mu_assert_int_eq(COUNTING_BLOOM_HASH_DOUBLE, bf.hash_mode);
+        mu_assert_int_eq(7, bf.number_hashes);
+        mu_assert_int_eq(479253, bf.number_bits);
+        mu_assert_int_eq(5000, bf.elements_added);
+        int errors = 0;
+        for (int i = 0; i < 5000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        mu_assert_int_eq(0, errors);
+        counting_bloom_destroy(&bf);
+    }
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_index_mode) {
+    char filepath[] = "./dist/test_bloom_import_index_mode.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.index_mode = COUNTING_BLOOM_INDEX_POWER_OF_TWO;
+    counting_bloom_init_on_disk_opts(&bf, 50000, 0.01, filepath, &opts);
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_destroy(&bf);
+
+    counting_bloom_import(&bf, filepath);
+    mu_assert_int_eq(COUNTING_BLOOM_INDEX_POWER_OF_TWO, bf.index_mode);
+    mu_assert_int_eq(COUNTING_BLOOM_HASH_SEEDED, bf.hash_mode);
+    mu_assert_int_eq(524288, bf.number_bits);
+    mu_assert_int_eq(5000, bf.elements_added);
+    int errors = 0;
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_hash_type) {
+    char filepath[] = "./dist/test_bloom_import_hash_type.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.hash_type = COUNTING_BLOOM_HASH_TYPE_WYHASH;
+    counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_export(&bf, filepath);
+    counting_bloom_destroy(&bf);
+
+    // no hash function is needed to use the built-in hash
+    counting_bloom_import(&bf, filepath);
+    mu_assert_int_eq(COUNTING_BLOOM_HASH_TYPE_WYHASH, bf.hash_type);
+    mu_assert_null(bf.hash_function);
+    int errors = 0;
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    mu_assert_int_eq(0, errors);
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_counter_width) {
+    char filepath[] = "./dist/test_bloom_import_counter_width.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 4;
+    counting_bloom_init_on_disk_opts(&bf, 50000, 0.01, filepath, &opts);
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+        if (i % 2 == 0)
+            counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_destroy(&bf);
+    mu_assert_int_eq((479253 + 1) / 2 + 20 + 40, fsize(filepath));
+
+    for (int on_disk = 0; on_disk < 2; ++on_disk) {
+        if (on_disk == 0)
+            counting_bloom_import(&bf, filepath);
+        else
+            counting_bloom_import_on_disk(&bf, filepath);
+        mu_assert_int_eq(4, bf.counter_width);
+        mu_assert_int_eq(7500, bf.elements_added);
+        int errors = 0;
+        for (int i = 0; i < 5000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_get_max_insertions(&bf, key) == (i % 2 == 0 ? 2 : 1) ? 0 : 1;
+        }
+        mu_assert_int_eq(0, errors);
+        counting_bloom_destroy(&bf);
+    }
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_blocked_layout) {
+    char filepath[] = "./dist/test_bloom_import_blocked_layout.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.layout = COUNTING_BLOOM_LAYOUT_BLOCKED;
+    counting_bloom_init_on_disk_opts(&bf, 10000, 0.01, filepath, &opts);
+    uint64_t number_bits = bf.number_bits;
+    for (int i = 0; i < 1000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_destroy(&bf);
+    mu_assert_int_eq(number_bits * 4 + 20 + 40, fsize(filepath));
+
+    for (int on_disk = 0; on_disk < 2; ++on_disk) {
+        if (on_disk == 0)
+            counting_bloom_import(&bf, filepath);
+        else
+            counting_bloom_import_on_disk(&bf, filepath);
+        mu_assert_int_eq(64, bf.block_size);
+        mu_assert_int_eq(number_bits, bf.number_bits);
+        int errors = 0;
+        for (int i = 0; i < 1000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        mu_assert_int_eq(0, errors);
+        counting_bloom_destroy(&bf);
+    }
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_page_blocked_layout) {
+    char filepath[] = "./dist/test_bloom_import_page_blocked_layout.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.layout = COUNTING_BLOOM_LAYOUT_PAGE_BLOCKED;
+    opts.block_size = 100;  // not a power of 2
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_init_on_disk_opts(&bf, 50000, 0.01, filepath, &opts));
+    opts.block_size = 32;  // smaller than a cache line
+    mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_init_on_disk_opts(&bf, 50000, 0.01, filepath, &opts));
+
+    opts.block_size = 0;
+    opts.counter_width = 8;
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_init_on_disk_opts(&bf, 50000, 0.01, filepath, &opts));
+    mu_assert_int_eq(COUNTING_BLOOM_PAGE_SIZE, bf.block_size);
+    mu_assert_int_eq(COUNTING_BLOOM_PAGE_SIZE, bf.__block_counters);
+    uint64_t number_bits = bf.number_bits;
+    mu_assert_int_eq(0, number_bits % COUNTING_BLOOM_PAGE_SIZE);
+    for (int i = 0; i < 5000; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+        if (i % 2 == 0)
+            counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_destroy(&bf);
+    mu_assert_int_eq(number_bits + 20 + 40, fsize(filepath));
+
+    for (int on_disk = 0; on_disk < 2; ++on_disk) {
+        if (on_disk == 0)
+            counting_bloom_import(&bf, filepath);
+        else
+            counting_bloom_import_on_disk(&bf, filepath);
+        mu_assert_int_eq(COUNTING_BLOOM_PAGE_SIZE, bf.block_size);
+        mu_assert_int_eq(8, bf.counter_width);
+        mu_assert_int_eq(number_bits, bf.number_bits);
+        int errors = 0, false_positives = 0;
+        for (int i = 0; i < 5000; ++i) {
+            char key[10] = {0};
+            sprintf(key, "%d", i);
+            errors += counting_bloom_get_max_insertions(&bf, key) == (i % 2 == 0 ? 2 : 1) ? 0 : 1;
+            sprintf(key, "x%d", i);
+            false_positives += counting_bloom_check_string(&bf, key) == COUNTING_BLOOM_SUCCESS ? 1 : 0;
+        }
+        mu_assert_int_eq(0, errors);
+        mu_assert(false_positives < 10, "page blocked layout false positive rate too high");  // only 5000 of 50000 inserted
+        counting_bloom_destroy(&bf);
+    }
+    remove(filepath);
+}
+
 /* NOTE: apparently import does not check all possible failures! */
 MU_TEST(test_bloom_import_fail) {
     char filepath[] = "./dist/test_bloom_import_fail.blm";
@@ -574,6 +2051,78 @@ MU_TEST(test_bloom_import_fail) {
     mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_import(&bf, filepath));
 }
 
+MU_TEST(test_bloom_import_invalid_extension) {
+    char filepath[] = "./dist/test_bloom_import_invalid_extension.blm";
+    CountingBloom bf;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 8;
+    opts.layout = COUNTING_BLOOM_LAYOUT_BLOCKED;
+    counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+    counting_bloom_add_string(&bf, "google");
+    uint64_t counter_bytes = bf.number_bits;
+    counting_bloom_destroy(&bf);
+
+    // the fields after number_bits: hashes, hash mode, index mode, hash type, counter width, block size
+    uint32_t fields[][2] = {{0, 0}, {0, 1000}, {1, 9}, {2, 9}, {3, 9}, {4, 7}, {4, 64}, {5, 16}, {5, 96}};
+    for (int f = -2; f < 9; ++f) {
+        counting_bloom_init_opts(&bf, 50000, 0.01, &opts);
+        counting_bloom_export(&bf, filepath);
+        counting_bloom_destroy(&bf);
+        FILE* fp = fopen(filepath, "r+b");
+        if (f == -2) {  // truncated
+            mu_assert_int_eq(0, ftruncate(fileno(fp), counter_bytes));
+        } else if (f == -1) {  // no counters
+            uint64_t number_bits = 0;
+            fseek(fp, counter_bytes, SEEK_SET);
+            fwrite(&number_bits, sizeof(uint64_t), 1, fp);
+        } else {
+            fseek(fp, counter_bytes + sizeof(uint64_t) + fields[f][0] * sizeof(uint32_t), SEEK_SET);
+            fwrite(&fields[f][1], sizeof(uint32_t), 1, fp);
+        }
+        fclose(fp);
+        mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_import(&bf, filepath));
+        mu_assert_int_eq(COUNTING_BLOOM_FAILURE, counting_bloom_import_on_disk(&bf, filepath));
+        mu_assert_null(bf.filepointer);
+    }
+    remove(filepath);
+}
+
+MU_TEST(test_bloom_import_legacy_size) {
+    // an extended file that is the same size as a legacy file of its parameters
+    // (522 32-bit counters and the trailer) must still be read with its extension
+    char filepath[] = "./dist/test_bloom_import_legacy_size.blm";
+    CountingBloom bf, res;
+    CountingBloomOptions opts;
+    counting_bloom_options_init(&opts);
+    opts.counter_width = 16;
+    opts.index_mode = COUNTING_BLOOM_INDEX_POWER_OF_TWO;
+    counting_bloom_init_opts(&bf, 50, 0.00665, &opts);
+    for (int i = 0; i < 50; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        counting_bloom_add_string(&bf, key);
+    }
+    counting_bloom_export(&bf, filepath);
+    FILE* fp = fopen(filepath, "rb");
+    fseek(fp, 0, SEEK_END);
+    mu_assert_int_eq(522 * 4 + 20, ftell(fp));
+    fclose(fp);
+
+    mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_import(&res, filepath));
+    mu_assert_int_eq(16, res.counter_width);
+    mu_assert_int_eq(COUNTING_BLOOM_INDEX_POWER_OF_TWO, res.index_mode);
+    mu_assert_int_eq(bf.number_bits, res.number_bits);
+    for (int i = 0; i < 50; ++i) {
+        char key[10] = {0};
+        sprintf(key, "%d", i);
+        mu_assert_int_eq(COUNTING_BLOOM_SUCCESS, counting_bloom_check_string(&res, key));
+    }
+    counting_bloom_destroy(&res);
+    counting_bloom_destroy(&bf);
+    remove(filepath);
+}
+
 MU_TEST(test_bloom_import_on_disk) {
     char filepath[] = "./dist/test_bloom_import.blm";
     for (int i = 0; i < 5000; ++i) {
@@ -667,13 +2216,46 @@ MU_TEST_SUITE(test_suite) {
     MU_RUN_TEST(test_bloom_setup_returns);
     MU_RUN_TEST(test_bloom_on_disk_setup);
     MU_RUN_TEST(test_bloom_on_disk_setup_returns);
+    MU_RUN_TEST(test_bloom_on_disk_setup_preallocate);
+    MU_RUN_TEST(test_bloom_on_disk_elements_added);
 
     /* hashes */
     MU_RUN_TEST(test_bloom_hashes_values);
     MU_RUN_TEST(test_bloom_hashes_start_collisions);
+    MU_RUN_TEST(test_bloom_hashes_into);
+    MU_RUN_TEST(test_bloom_hashes_many_seeds);
+    MU_RUN_TEST(test_bloom_hashes_into_legacy_adapter);
+    MU_RUN_TEST(test_bloom_hashes_into_options);
+    MU_RUN_TEST(test_bloom_hashes_double);
+    MU_RUN_TEST(test_bloom_hashes_bytes);
+    MU_RUN_TEST(test_bloom_hashes_bytes_string_adapter);
+    MU_RUN_TEST(test_bloom_hashes_builtin);
 
     /* set and contains */
     MU_RUN_TEST(test_bloom_set);
+    MU_RUN_TEST(test_bloom_bytes);
+    MU_RUN_TEST(test_bloom_u64);
+    MU_RUN_TEST(test_bloom_add_batch);
+    MU_RUN_TEST(test_bloom_check_batch);
+    MU_RUN_TEST(test_bloom_remove_batch);
+    MU_RUN_TEST(test_bloom_check_and_add);
+    MU_RUN_TEST(test_bloom_index_modes);
+    MU_RUN_TEST(test_bloom_counter_widths);
+    MU_RUN_TEST(test_bloom_counter_width_saturation);
+    MU_RUN_TEST(test_bloom_merge);
+    MU_RUN_TEST(test_bloom_bulk_build);
+    MU_RUN_TEST(test_bloom_pipeline_add);
+    MU_RUN_TEST(test_bloom_blocked_layout);
+    MU_RUN_TEST(test_bloom_probe);
+    MU_RUN_TEST(test_bloom_concurrent);
+    MU_RUN_TEST(test_bloom_deltas);
+    MU_RUN_TEST(test_bloom_shared);
+    MU_RUN_TEST(test_bloom_replica);
+    MU_RUN_TEST(test_bloom_replica_replace);
+    MU_RUN_TEST(test_bloom_open_replica_invalid_header);
+    MU_RUN_TEST(test_bloom_sharded);
+    MU_RUN_TEST(test_bloom_sharded_false_positive_rate);
+    MU_RUN_TEST(test_bloom_snapshots);
     MU_RUN_TEST(test_bloom_set_failure);
     MU_RUN_TEST(test_bloom_set_on_disk);
     MU_RUN_TEST(test_bloom_check);
@@ -695,13 +2277,22 @@ MU_TEST_SUITE(test_suite) {
     MU_RUN_TEST(test_bloom_current_false_positive_rate);
     MU_RUN_TEST(test_bloom_count_set_bits);
     MU_RUN_TEST(test_bloom_export_size);
+    MU_RUN_TEST(test_bloom_export_size_counter_width);
     // MU_RUN_TEST(test_bloom_estimate_elements);
 
     /* export, import */
     MU_RUN_TEST(test_bloom_export);
     MU_RUN_TEST(test_bloom_export_on_disk);
     MU_RUN_TEST(test_bloom_import);
+    MU_RUN_TEST(test_bloom_import_double_hashing);
+    MU_RUN_TEST(test_bloom_import_index_mode);
+    MU_RUN_TEST(test_bloom_import_hash_type);
+    MU_RUN_TEST(test_bloom_import_counter_width);
+    MU_RUN_TEST(test_bloom_import_blocked_layout);
+    MU_RUN_TEST(test_bloom_import_page_blocked_layout);
     MU_RUN_TEST(test_bloom_import_fail);
+    MU_RUN_TEST(test_bloom_import_invalid_extension);
+    MU_RUN_TEST(test_bloom_import_legacy_size);
     MU_RUN_TEST(test_bloom_import_on_disk);
     MU_RUN_TEST(test_bloom_import_on_disk_fail);
 
@@ -787,3 +2378,95 @@ static off_t fsize(const char* filename) {
 
     return -1;
 }
+
+/* simple hash functions to test passing in a hashing function */
+static uint64_t* legacy_hash(int num_hashes, const char* str) {
+    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
+    legacy_hash_into(num_hashes, str, results);
+    return results;
+}
+
+static void legacy_hash_into(int num_hashes, const char* str, uint64_t* results) {
+    for (int i = 0; i < num_hashes; ++i)
+        results[i] = strlen(str) + i;
+}
+
+/* add the shared keys and this thread's keys; alternate single and batch adds */
+static void* concurrent_add(void* arg) {
+    StressArgs* args = (StressArgs*)arg;
+    char data[2][100][16];
+    const char* keys[2][100];
+    for (int i = 0; i < STRESS_KEYS; i += 100) {
+        for (int j = 0; j < 100; ++j) {
+            sprintf(data[0][j], "%d", i + j);
+            sprintf(data[1][j], "t%d-%d", args->thread, j);
+            keys[0][j] = data[0][j];
+            keys[1][j] = data[1][j];
+        }
+        if (i % 200 == 0) {
+            counting_bloom_add_batch(args->bf, keys[0], NULL, 100);
+            counting_bloom_add_batch(args->bf, keys[1], NULL, 100);
+        } else {
+            for (int j = 0; j < 100; ++j) {
+                counting_bloom_add_string(args->bf, keys[0][j]);
+                counting_bloom_add_string(args->bf, keys[1][j]);
+                counting_bloom_check_string(args->bf, keys[0][(j * 7) % 100]);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void* concurrent_remove(void* arg) {
+    StressArgs* args = (StressArgs*)arg;
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        char key[16] = {0};
+        sprintf(key, "%d", (i + args->thread * 500) % STRESS_KEYS);
+        args->errors += counting_bloom_remove_string(args->bf, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    return NULL;
+}
+
+static void* sharded_add(void* arg) {
+    ShardedArgs* args = (ShardedArgs*)arg;
+    args->errors += counting_bloom_sharded_place(args->cbs, args->thread) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        char key[16] = {0};
+        sprintf(key, "%d", i);
+        args->errors += counting_bloom_sharded_add_string(args->cbs, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        sprintf(key, "t%d-%d", args->thread, i);
+        args->errors += counting_bloom_sharded_add_bytes(args->cbs, key, strlen(key)) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    return NULL;
+}
+
+/* the first 3 elements added are google, facebook, and twitter; the rest are the keys in order */
+static void* snapshot_reader(void* arg) {
+    SnapshotArgs* args = (SnapshotArgs*)arg;
+    while (__atomic_load_n(args->done, __ATOMIC_ACQUIRE) == 0 || args->reads == 0) {
+        const CountingBloom* snap = counting_bloom_snapshots_acquire(args->snaps, args->reader);
+        for (uint64_t i = 3; i < snap->elements_added; i += 7) {
+            char key[16] = {0};
+            sprintf(key, "%" PRIu64, i - 3);
+            args->errors += counting_bloom_check_string(snap, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        }
+        counting_bloom_snapshots_release(args->snaps, args->reader);
+        ++args->reads;
+    }
+    return NULL;
+}
+
+static void* deltas_add(void* arg) {
+    StressArgs* args = (StressArgs*)arg;
+    CountingBloomDeltas deltas;
+    args->errors += counting_bloom_deltas_init(&deltas, args->bf, 256) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    for (int i = 0; i < STRESS_KEYS; ++i) {
+        char key[16] = {0};
+        sprintf(key, "hot-%d", i % 10);
+        args->errors += counting_bloom_deltas_add_string(&deltas, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+        sprintf(key, "t%d-%d", args->thread, i);
+        args->errors += counting_bloom_deltas_add_string(&deltas, key) == COUNTING_BLOOM_SUCCESS ? 0 : 1;
+    }
+    counting_bloom_deltas_destroy(&deltas);
+    return NULL;
+}